@@ -1,6 +1,4 @@
-#include <math.h>
 #include <stdint.h>
-#include <stdio.h>
 
 #include "hardware/pio.h"
 
@@ -18,18 +16,6 @@ static unsigned int offset;
 /* Where is the wiper set on the AD5220? (0 to 128) */
 static unsigned int cursor;
 
-/* We want the peak of the measured waveform to be at this level:
- * high enough to use the ADC range but not so high that we clip. */
-#define AGC_TARGET 2800
-
-/* Measurements above this level are not really linear - the current
- * is limited by the resistor more than by the phototransistor. */
-#define AGC_CEILING 3600
-
-/* Measurements below this level are not really linear either, as
- * the DAC's internal offsets become noticeable. */
- #define AGC_FLOOR 500
-
 /* Set up the AGC hardware. */
 void agc_init(unsigned int dir_pin, unsigned int clock_pin)
 {
@@ -73,44 +59,33 @@ static uint16_t measure_peak(uint16_t *buffer)
 
 /* Adjust the gain so that the waveform fits into the ADC's range.
  * @buffer must be at least AGC_SAMPLE uint16_ts long,
- * and will be overwritten. */
-void agc_run(uint16_t *buffer)
+ * and will be overwritten.
+ * Returns the last peak level it measured. */
+uint16_t agc_run(uint16_t *buffer)
 {
     uint16_t peak;
 
     /* This usually converges in two or three cycles.
      * Run four for safety and so the last peak measurement
      * is likely to be representative of the actual levels. */
-    for (unsigned int i = 0; i < 4; i++) {
-        /* Where are we now? */
+    for (unsigned int i = 0; i < AGC_ROUNDS; i++) {
         peak = measure_peak(buffer);
+        agc_set_level(agc_step(cursor, peak));
+    }
 
-        /* In the mid-range, the phototransistor current is proportional
-         * to the brightness, and the measured voltage is proportional to
-         * that and to the resistance (V = IR).  Adjust the resistance
-         * to bring the peak measurement to the target. */
-        float ohms = AGC_OHMS(cursor);
-        float new_ohms = ohms * AGC_TARGET / peak;
-        int new_level = roundf(AGC_LEVEL(new_ohms));
-
-        /* If we're above the linear range then the linear model
-         * will adjust too slowly, so do something more dramatic. */
-        if (peak > AGC_CEILING) {
-            new_level = cursor / 10;
-        }
-
-        /* Don't go outside the range of the AD5220. */
-        if (new_level < 0) {
-            new_level = 0;
-        }
-        if (new_level > 127) {
-            new_level = 127;
-        }
+    return peak;
+}
 
-        agc_set_level(new_level);
-    }
+/* Where the AGC is set now, from 0 to 127. */
+unsigned int agc_level(void)
+{
+    return cursor;
+}
 
-    printf("AGC: %d/127%s\n", cursor,
-            (peak > AGC_CEILING) ? " (TOO BRIGHT)" :
-            (peak < AGC_FLOOR) ? " (TOO DARK)" : "");
+/* Describe a peak level from agc_run(): a warning if the light
+ * was outside the range we can measure well, otherwise "". */
+const char *agc_warning(uint16_t peak)
+{
+    return (peak > AGC_CEILING) ? " (TOO BRIGHT)" :
+           (peak < AGC_FLOOR) ? " (TOO DARK)" : "";
 }
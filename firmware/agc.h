@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 /* Set up the AGC hardware. */
 void agc_init(unsigned int dir_pin, unsigned int clock_pin);
 
@@ -8,8 +10,36 @@ extern void agc_reset(void);
 
 /* Adjust the gain so that the waveform fits into the ADC's range.
  * @buffer must be at least AGC_SAMPLE uint16_ts long,
- * and will be overwritten. */
-extern void agc_run(uint16_t *buffer);
+ * and will be overwritten.
+ * Returns the last peak level it measured. */
+extern uint16_t agc_run(uint16_t *buffer);
+
+/* The control law agc_run() uses: the next potentiometer level,
+ * given the current @level and the @peak measured there. */
+extern unsigned int agc_step(unsigned int level, uint16_t peak);
+
+/* Where the AGC is set now, from 0 to 127. */
+extern unsigned int agc_level(void);
+
+/* Describe a peak level from agc_run(): a warning if the light
+ * was outside the range we can measure well, otherwise "". */
+extern const char *agc_warning(uint16_t peak);
+
+/* We want the peak of the measured waveform to be at this level:
+ * high enough to use the ADC range but not so high that we clip. */
+#define AGC_TARGET 2800
+
+/* Measurements above this level are not really linear - the current
+ * is limited by the resistor more than by the phototransistor. */
+#define AGC_CEILING 3600
+
+/* Measurements below this level are not really linear either, as
+ * the DAC's internal offsets become noticeable. */
+#define AGC_FLOOR 500
+
+/* How many times agc_run() measures and adjusts.
+ * host/agc-sim measures how many it really needs. */
+#define AGC_ROUNDS 4
 
 /* Internal sampling for the AGC: 20ms,
  * long enough to catch a cycle of 50Hz */
@@ -0,0 +1,42 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "agc.h"
+
+/* The AGC control law, kept apart from the hardware so it can be
+ * run against a simulated circuit on a PC (see host/agc-sim.c). */
+
+/* Choose the next potentiometer level, given the current @level
+ * and the @peak we measured there. */
+unsigned int agc_step(unsigned int level, uint16_t peak)
+{
+    int new_level;
+
+    /* Pitch black (or not connected): all the gain we've got. */
+    if (peak == 0) {
+        return 127;
+    }
+
+    /* In the mid-range, the phototransistor current is proportional
+     * to the brightness, and the measured voltage is proportional to
+     * that and to the resistance (V = IR).  Adjust the resistance
+     * to bring the peak measurement to the target. */
+    float ohms = AGC_OHMS(level);
+    float new_ohms = ohms * AGC_TARGET / peak;
+    new_level = roundf(AGC_LEVEL(new_ohms));
+
+    /* If we're above the linear range then the linear model
+     * will adjust too slowly, so do something more dramatic. */
+    if (peak > AGC_CEILING) {
+        new_level = level / 10;
+    }
+
+    /* Don't go outside the range of the AD5220. */
+    if (new_level < 0) {
+        new_level = 0;
+    }
+    if (new_level > 127) {
+        new_level = 127;
+    }
+    return new_level;
+}
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "assertions.h"
+#include "command.h"
+#include "output.h"
+
+/* Longest command line we accept, and most words on it. */
+#define LINE_LENGTH 64u
+#define MAX_WORDS 8u
+
+/* The line being typed. */
+static char line[LINE_LENGTH];
+static unsigned int length;
+static bool overflow;
+
+/* Sequence number of the current command.  Every line we act on
+ * gets the next number, whether or not it's valid. */
+static unsigned int sequence;
+static bool replied;
+
+/* Queue one tagged reply line. */
+static void reply(const char *status, const char *format, va_list args)
+{
+    char text[LINE_LENGTH + 32];
+
+    ASSERT(!replied);
+    replied = true;
+    vsnprintf(text, sizeof text, format, args);
+    output_text("#%u %s %s\n", sequence, status, text);
+}
+
+/* Answer the command being run. */
+void command_ok(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    reply("OK", format, args);
+    va_end(args);
+}
+
+void command_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    reply("ERROR", format, args);
+    va_end(args);
+}
+
+/* Parse an unsigned number argument.  Returns false if it isn't one. */
+bool command_number(const char *arg, unsigned int *value)
+{
+    char *end;
+    /* strtoul() says a number too big for it is ULONG_MAX, which is
+     * also a number; only errno tells them apart. */
+    errno = 0;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (*arg < '0' || *arg > '9' || *end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    *value = n;
+    return true;
+}
+
+/* List the commands we know about. */
+static void help(const struct command *commands)
+{
+    for (const struct command *c = commands; c->name; c++) {
+        output_text("  %s %s\n", c->name, c->usage);
+    }
+    command_ok("help");
+}
+
+/* Split a line into words and run it. */
+static void run_line(const struct command *commands)
+{
+    char *argv[MAX_WORDS];
+    unsigned int argc = 0;
+    char *p = line;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t') {
+            *p++ = '\0';
+        }
+        if (!*p) {
+            break;
+        }
+        if (argc == MAX_WORDS) {
+            command_error("too many arguments");
+            return;
+        }
+        argv[argc++] = p;
+        while (*p && *p != ' ' && *p != '\t') {
+            p++;
+        }
+    }
+    if (argc == 0) {
+        /* Blank lines are ignored, and don't use up a number. */
+        sequence--;
+        replied = true;
+        return;
+    }
+
+    if (!strcmp(argv[0], "help")) {
+        help(commands);
+        return;
+    }
+    for (const struct command *c = commands; c->name; c++) {
+        if (!strcmp(argv[0], c->name)) {
+            c->run(argc, argv);
+            return;
+        }
+    }
+    command_error("unknown command '%s'", argv[0]);
+}
+
+/* Read any console input that's waiting and run each complete line. */
+void command_poll(const struct command *commands)
+{
+    int c;
+
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        if (c != '\r' && c != '\n') {
+            if (length < LINE_LENGTH - 1) {
+                line[length++] = c;
+            } else {
+                overflow = true;
+            }
+            continue;
+        }
+        if (length == 0 && !overflow) {
+            continue;
+        }
+
+        sequence++;
+        replied = false;
+        line[length] = '\0';
+        if (overflow) {
+            command_error("line too long");
+        } else {
+            run_line(commands);
+        }
+        ASSERT(replied);
+        length = 0;
+        overflow = false;
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* A command that can be typed on the USB console.
+ * @run gets the words of the line, with argv[0] being the command name,
+ * and must answer with exactly one command_ok() or command_error(). */
+struct command {
+    const char *name;
+    const char *usage;
+    void (*run)(unsigned int argc, char **argv);
+};
+
+/* Read any console input that's waiting and run each complete line.
+ * @commands ends with an entry whose name is NULL.  Never blocks. */
+extern void command_poll(const struct command *commands);
+
+/* Answer the command being run.  Replies are tagged with the
+ * command's sequence number, so a host can match them up. */
+extern void command_ok(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+extern void command_error(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/* Parse an unsigned number argument.  Returns false if it isn't one. */
+extern bool command_number(const char *arg, unsigned int *value);
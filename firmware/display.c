@@ -0,0 +1,208 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "assertions.h"
+#include "display.h"
+#include "graph.h"
+#include "output.h"
+
+/* Show each report on a little screen as well as the console: the
+ * frequency and flicker percentage across the top, the spectrum and
+ * waveform graphs in the middle, and the AGC setting at the bottom.
+ *
+ * This part only draws, and works out what's changed; drivers do
+ * the sending, so it builds on the host too.  Most of the screen
+ * stays the same from one measurement to the next, so only the
+ * changed columns of each page go to the panel. */
+
+/* Where the graphs go, centred. */
+#define GRAPH_X ((DISPLAY_WIDTH - GRAPH_WIDTH) / 2)
+#define SPECTRUM_Y 10u
+#define WAVEFORM_Y 34u
+
+/* Text lines, by page. */
+#define TOP_PAGE 0u
+#define BOTTOM_PAGE (DISPLAY_PAGES - 1)
+
+/* Characters are 5x7, in 6-column cells. */
+#define GLYPH_WIDTH 5u
+#define CELL_WIDTH 6u
+
+/* Just the characters we need, in the same column-per-byte
+ * layout as the panel.  Anything else comes out blank. */
+static const char glyph_chars[] = " %-./0123456789ACGHz";
+static const uint8_t glyphs[][GLYPH_WIDTH] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 },   /* space */
+    { 0x23, 0x13, 0x08, 0x64, 0x62 },   /* % */
+    { 0x08, 0x08, 0x08, 0x08, 0x08 },   /* - */
+    { 0x00, 0x60, 0x60, 0x00, 0x00 },   /* . */
+    { 0x20, 0x10, 0x08, 0x04, 0x02 },   /* / */
+    { 0x3e, 0x51, 0x49, 0x45, 0x3e },   /* 0 */
+    { 0x00, 0x42, 0x7f, 0x40, 0x00 },   /* 1 */
+    { 0x42, 0x61, 0x51, 0x49, 0x46 },   /* 2 */
+    { 0x21, 0x41, 0x45, 0x4b, 0x31 },   /* 3 */
+    { 0x18, 0x14, 0x12, 0x7f, 0x10 },   /* 4 */
+    { 0x27, 0x45, 0x45, 0x45, 0x39 },   /* 5 */
+    { 0x3c, 0x4a, 0x49, 0x49, 0x30 },   /* 6 */
+    { 0x01, 0x71, 0x09, 0x05, 0x03 },   /* 7 */
+    { 0x36, 0x49, 0x49, 0x49, 0x36 },   /* 8 */
+    { 0x06, 0x49, 0x49, 0x29, 0x1e },   /* 9 */
+    { 0x7e, 0x11, 0x11, 0x11, 0x7e },   /* A */
+    { 0x3e, 0x41, 0x41, 0x41, 0x22 },   /* C */
+    { 0x3e, 0x41, 0x49, 0x49, 0x7a },   /* G */
+    { 0x7f, 0x08, 0x08, 0x08, 0x7f },   /* H */
+    { 0x44, 0x64, 0x54, 0x4c, 0x44 },   /* z */
+};
+
+/* Longest line that fits. */
+#define LINE_LENGTH (DISPLAY_WIDTH / CELL_WIDTH)
+
+/* The driver, if we found a panel. */
+static const struct display_driver *display;
+
+/* What the panel is showing, and the next frame. */
+static struct display_frame shown, next;
+
+/* The panel's memory is random at power-up, so the first
+ * frame has to go in full. */
+static bool first_frame;
+
+/* Write @text on @page, starting at column @x.  Anything that
+ * doesn't fit is cut off. */
+static void draw_text(struct display_frame *frame,
+                      unsigned int page,
+                      unsigned int x,
+                      const char *text)
+{
+    for (; *text && x + GLYPH_WIDTH <= DISPLAY_WIDTH; text++) {
+        const char *c = strchr(glyph_chars, *text);
+        const uint8_t *glyph = glyphs[c ? c - glyph_chars : 0];
+
+        memcpy(&frame->page[page][x], glyph, GLYPH_WIDTH);
+        x += CELL_WIDTH;
+    }
+}
+
+/* The same, ending at the right-hand edge. */
+static void draw_text_right(struct display_frame *frame,
+                            unsigned int page,
+                            const char *text)
+{
+    unsigned int length = strlen(text);
+    if (length > LINE_LENGTH) {
+        length = LINE_LENGTH;
+    }
+    draw_text(frame, page, DISPLAY_WIDTH - length * CELL_WIDTH + 1, text);
+}
+
+/* Copy a graph's frame (see graph.h) onto the screen
+ * with its top left corner at (@x, @y). */
+static void draw_graph(struct display_frame *frame,
+                       const uint8_t *graph,
+                       unsigned int x,
+                       unsigned int y)
+{
+    ASSERT(x + GRAPH_WIDTH <= DISPLAY_WIDTH);
+    ASSERT(y + GRAPH_HEIGHT <= DISPLAY_HEIGHT);
+
+    for (unsigned int gy = 0; gy < GRAPH_HEIGHT; gy++) {
+        unsigned int row = y + gy;
+        uint8_t mask = 1u << (row % 8);
+        uint8_t *out = &frame->page[row / 8][x];
+
+        for (unsigned int gx = 0; gx < GRAPH_WIDTH; gx++) {
+            unsigned int bit = gy * GRAPH_WIDTH + gx;
+            if (graph[bit / 8] >> (bit % 8) & 1u) {
+                out[gx] |= mask;
+            }
+        }
+    }
+}
+
+/* Draw @report into @frame. */
+void display_render(const struct report *report,
+                    struct display_frame *frame)
+{
+    char line[LINE_LENGTH + 1];
+    float frequency = (report->harmonics > 0) ?
+        report->harmonic[0].frequency : report->frequency;
+
+    memset(frame, 0, sizeof *frame);
+
+    snprintf(line, sizeof line, "%.1fHz", frequency);
+    draw_text(frame, TOP_PAGE, 0, line);
+    snprintf(line, sizeof line, "%d%%", report->flicker);
+    draw_text_right(frame, TOP_PAGE, line);
+
+    draw_graph(frame, report->spectrum, GRAPH_X, SPECTRUM_Y);
+    draw_graph(frame, report->waveform, GRAPH_X, WAVEFORM_Y);
+
+    snprintf(line, sizeof line, "AGC %u/127", report->agc_level);
+    draw_text(frame, BOTTOM_PAGE, 0, line);
+}
+
+/* Find the changed columns of each page. */
+void display_diff(const struct display_frame *shown,
+                  const struct display_frame *next,
+                  struct display_span spans[DISPLAY_PAGES])
+{
+    for (unsigned int p = 0; p < DISPLAY_PAGES; p++) {
+        const uint8_t *a = shown->page[p], *b = next->page[p];
+        unsigned int first = 0, last = DISPLAY_WIDTH - 1;
+
+        while (first < DISPLAY_WIDTH && a[first] == b[first]) {
+            first++;
+        }
+        if (first == DISPLAY_WIDTH) {
+            spans[p].first = 1;
+            spans[p].last = 0;
+            continue;
+        }
+        while (a[last] == b[last]) {
+            last--;
+        }
+        spans[p].first = first;
+        spans[p].last = last;
+    }
+}
+
+/* Use @driver from now on. */
+bool display_init(const struct display_driver *driver)
+{
+    if (!driver->init()) {
+        return false;
+    }
+    display = driver;
+    first_frame = true;
+    return true;
+}
+
+/* Draw @report and send whatever's changed. */
+void display_show(const struct report *report)
+{
+    struct display_span spans[DISPLAY_PAGES];
+
+    if (!display) {
+        return;
+    }
+
+    display_render(report, &next);
+    if (first_frame) {
+        for (unsigned int p = 0; p < DISPLAY_PAGES; p++) {
+            spans[p].first = 0;
+            spans[p].last = DISPLAY_WIDTH - 1;
+        }
+        first_frame = false;
+    } else {
+        display_diff(&shown, &next, spans);
+    }
+
+    /* If the last update went astray, this one was worked out against
+     * a frame the panel never got: send the whole of the next one. */
+    if (!display->update(&next, spans)) {
+        first_frame = true;
+    }
+    shown = next;
+}
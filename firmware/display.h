@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "output.h"
+
+/* A small monochrome panel, such as the common 128x64 SSD1306 OLEDs.
+ * Its memory is in pages of 8 rows: one byte per column per page,
+ * with the top row in bit 0. */
+#define DISPLAY_WIDTH 128u
+#define DISPLAY_HEIGHT 64u
+#define DISPLAY_PAGES (DISPLAY_HEIGHT / 8u)
+
+/* A whole screen, in the panel's layout. */
+struct display_frame {
+    uint8_t page[DISPLAY_PAGES][DISPLAY_WIDTH];
+};
+
+/* The columns of one page that need sending, first to last;
+ * first > last if the page hasn't changed. */
+struct display_span {
+    uint8_t first, last;
+};
+
+/* Something to show frames on. */
+struct display_driver {
+    /* Set up the hardware.  Returns false if there's no panel. */
+    bool (*init)(void);
+    /* Start sending the changed parts of @frame to the panel, and
+     * return without waiting for them to get there.  The driver takes
+     * its own copy, so @frame can be redrawn straight away; it waits
+     * for the previous update itself if that's still going.  Returns
+     * false if that previous update didn't all get there, so the
+     * panel no longer shows what we think it does. */
+    bool (*update)(const struct display_frame *frame,
+                   const struct display_span spans[DISPLAY_PAGES]);
+};
+
+/* Use @driver from now on.  Returns false, and leaves the display
+ * off, if it can't find its panel. */
+extern bool display_init(const struct display_driver *driver);
+
+/* Draw @report and send whatever's changed since the last one.
+ * Does nothing if there's no display. */
+extern void display_show(const struct report *report);
+
+/* Draw @report into @frame, without showing it. */
+extern void display_render(const struct report *report,
+                           struct display_frame *frame);
+
+/* Work out which parts of @next differ from @shown. */
+extern void display_diff(const struct display_frame *shown,
+                         const struct display_frame *next,
+                         struct display_span spans[DISPLAY_PAGES]);
+
+/* Driver for an SSD1306 on I2C, with its data and clock on these
+ * pins, in ssd1306.c. */
+extern const struct display_driver *ssd1306(unsigned int sda_pin,
+                                            unsigned int scl_pin);
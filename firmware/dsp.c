@@ -1,18 +1,37 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 
 #include "assertions.h"
 #include "dsp.h"
+#include "fastmath.h"
 #include "sample.h"
 
+/* Fit a Gaussian curve through three equally-spaced magnitudes
+ * and find its highest point.  Returns the offset of that point from
+ * @middle, in units of the spacing, and sets @height to its value.
+ *
+ * See M. Gasior and J. L. Gonzalez, "Improving FFT Frequency
+ * Measurement Resolution by Parabolic and Gaussian Spectrum
+ * Interpolation", AIP Conference Proceedings 732, 276-285 (2004). */
+static float gaussian_fit(float low, float middle, float high, float *height)
+{
+    /* A Gaussian is a parabola on a log scale.  Any base will do. */
+    float l = fast_log2f(low), m = fast_log2f(middle), h = fast_log2f(high);
+    float slope = (h - l) / 2;
+    float curve = (h + l - 2 * m) / 2;
+    float adjust = -slope / (2 * curve);
+
+    *height = fast_exp2f(m - slope * slope / (4 * curve));
+    return adjust;
+}
+
 /* Find the dominant frequency in the FFT. 
  * Returns a *normalized* frequency, in buckets. */
 float peak(float *magnitudes, unsigned int count)
 {
     unsigned int i, max_index = 0;
-    float high, middle, low, adjust, max_val = -1;
+    float height, max_val = -1;
 
     /* Find the bucket with the highest magnitude.
      * Skip bucket 0 (DC), though it should be 0 anyway
@@ -31,34 +50,37 @@ float peak(float *magnitudes, unsigned int count)
 
     /* That gets us a first guess at the frequency, but only to the
      * nearest bucket.  Fit a Gaussian curve to the three magnitudes
-     * around that point and pick the highest point on that curve.
-     * 
-     * See M. Gasior and J. L. Gonzalez, "Improving FFT Frequency
-     * Measurement Resolution by Parabolic and Gaussian Spectrum
-     * Interpolation", AIP Conference Proceedings 732, 276-285 (2004). */
-    high = magnitudes[max_index + 1];
-    middle = magnitudes[max_index];
-    low = magnitudes[max_index - 1];
-    adjust = log(high/low)/(2.0 * log((middle * middle)/(high * low)));
-
-    return max_index + adjust;
+     * around that point and pick the highest point on that curve. */
+    return max_index + gaussian_fit(magnitudes[max_index - 1],
+                                    magnitudes[max_index],
+                                    magnitudes[max_index + 1],
+                                    &height);
 }
 
-/* Convert uint16_t samples to complex floats, windowed for FFT'ing.
- * Returns false on error. */
-bool window(const uint16_t *samples,
-            float *real,
-            float *imag,
-            unsigned int count)
+/* Find the mean of samples (8-bit if @narrow). */
+static float mean_generic(const void *samples,
+                          bool narrow,
+                          unsigned int count)
 {
-    unsigned int i;
-    float t, window, sum = 0.0, mean, middle;
+    float sum = 0.0;
 
-    /* Find the mean so we can remove DC. */
-    for (i = 0; i < count; i++) {
-        sum += samples[i];
+    for (unsigned int i = 0; i < count; i++) {
+        sum += sample_at(samples, narrow, i);
     }
-    mean = sum / count;
+    return sum / count;
+}
+
+/* Convert samples (8-bit if @narrow) to complex floats, windowed
+ * for FFT'ing, taking out DC at @mean.  Returns false on error. */
+static bool window_generic(const void *samples,
+                           bool narrow,
+                           float mean,
+                           float *real,
+                           float *imag,
+                           unsigned int count)
+{
+    unsigned int i;
+    float t, window, middle;
 
     /* We'll apply a windowing function to the samples before
      * the FFT.  This reduces edge effects that crop up because
@@ -66,8 +88,8 @@ bool window(const uint16_t *samples,
      * assumes that it does.
      *
      * Our window function is "Gaussian, r = 8" from Gasior and Gonzalez.
-     * it's relatively expensive, but we're not optimizing yet, and
-     * it lets us use Gaussian interpolation on the results.
+     * it's relatively expensive, even with fast_expf(), but it lets us
+     * use Gaussian interpolation on the results.
      *
      * It's e^(-r^2*t^2/(2L^2)) where
      *  L = window length,
@@ -78,16 +100,14 @@ bool window(const uint16_t *samples,
     middle = (float)(count - 1) / 2;
 
     for (i = 0; i < count; i++) {
-        uint16_t s = samples[i];
+        unsigned int s = sample_at(samples, narrow, i);
         if (s & SAMPLE_ERROR) {
-            printf("Sampling error at %d/%d: 0x%4.4x\n",
-                i, count, s);
             return false;
         }
 
         /* Calculate the window function. */
         t = (float)i - middle;
-        window = expf(K*t*t);
+        window = fast_expf(K*t*t);
 
         /* Remove DC and apply the window. */
         real[i] = window * ((float)s - mean);
@@ -96,6 +116,246 @@ bool window(const uint16_t *samples,
     return true;
 }
 
+/* Convert uint16_t samples to complex floats, windowed for FFT'ing.
+ * Returns false on error. */
+bool window(const uint16_t *samples,
+            float *real,
+            float *imag,
+            unsigned int count)
+{
+    float mean = mean_generic(samples, false, count);
+    return window_generic(samples, false, mean, real, imag, count);
+}
+
+/* The same for 8-bit samples.  They have no error flag, so this
+ * can't fail. */
+void window8(const uint8_t *samples,
+             float *real,
+             float *imag,
+             unsigned int count)
+{
+    float mean = mean_generic(samples, true, count);
+    window_generic(samples, true, mean, real, imag, count);
+}
+
+/* The same again, with the mean worked out from the sum that
+ * sample() or sample8() returned, saving a pass over the samples. */
+bool window_sum(const uint16_t *samples,
+                uint32_t sum,
+                float *real,
+                float *imag,
+                unsigned int count)
+{
+    return window_generic(samples, false, (float) sum / count,
+                          real, imag, count);
+}
+
+void window8_sum(const uint8_t *samples,
+                 uint32_t sum,
+                 float *real,
+                 float *imag,
+                 unsigned int count)
+{
+    window_generic(samples, true, (float) sum / count, real, imag, count);
+}
+
+/* Fill in bad samples from their neighbours. */
+unsigned int repair(uint16_t *samples, unsigned int count, uint32_t *sum)
+{
+    unsigned int errors = 0;
+    unsigned int i = 0;
+
+    while (i < count) {
+        if (!(samples[i] & SAMPLE_ERROR)) {
+            i++;
+            continue;
+        }
+
+        /* A run of bad samples from i up to, not including, end. */
+        unsigned int end = i + 1;
+        while (end < count && (samples[end] & SAMPLE_ERROR)) {
+            end++;
+        }
+        unsigned int run = end - i;
+        errors += run;
+
+        /* Too long to guess at, or nothing good to go on. */
+        if (run > REPAIR_MAX_RUN || (i == 0 && end == count)) {
+            i = end;
+            continue;
+        }
+
+        int before = (i > 0) ? samples[i - 1] : samples[end];
+        int after = (end < count) ? samples[end] : before;
+        for (unsigned int j = 0; j < run; j++) {
+            uint16_t s = before + (after - before) * (int)(j + 1) /
+                                  (int)(run + 1);
+            if (sum) {
+                *sum += s - samples[i + j];
+            }
+            samples[i + j] = s;
+        }
+        i = end;
+    }
+    return errors;
+}
+
+/* Look more closely at the spectrum around some peaks we've already
+ * found to the nearest bucket or so.  For each peak, we work out the
+ * spectrum at ZOOM_POINTS frequencies ZOOM_SPACING buckets apart,
+ * centred on the first guess, and fit a Gaussian to the best three.
+ * That's much finer than the FFT's buckets without needing a longer
+ * capture or a bigger FFT.  @samples must be the same ones that went
+ * into the FFT, and get the same window.
+ *
+ * Each frequency gets its own Goertzel filter; they all run together
+ * in one pass over the samples so we only window each sample once.
+ * We use Reinsch's form of the filter, which stays accurate at the
+ * low frequencies we care about, where the usual 2cos(w) coefficient
+ * gets too close to 2 for a float to tell the difference.
+ * See G. Goertzel, "An Algorithm for the Evaluation of Finite
+ * Trigonometric Series", American Mathematical Monthly 65(1), 1958,
+ * and J. Stoer and R. Bulirsch, "Introduction to Numerical Analysis",
+ * section 2.3.3. */
+static void zoom_generic(const void *samples,
+                         bool narrow,
+                         unsigned int count,
+                         struct zoom *peaks,
+                         unsigned int npeaks)
+{
+    float k[ZOOM_MAX_PEAKS][ZOOM_POINTS];
+    float s[ZOOM_MAX_PEAKS][ZOOM_POINTS];
+    float d[ZOOM_MAX_PEAKS][ZOOM_POINTS];
+    unsigned int i, p, j;
+    float t, sum = 0.0, mean, middle;
+
+    ASSERT(npeaks <= ZOOM_MAX_PEAKS);
+
+    /* Filter coefficients: 4sin^2(w/2) for each frequency w. */
+    for (p = 0; p < npeaks; p++) {
+        for (j = 0; j < ZOOM_POINTS; j++) {
+            float bucket = peaks[p].bucket +
+                ZOOM_SPACING * ((float)j - (ZOOM_POINTS - 1) / 2);
+            float half_w = (float)M_PI * bucket / count;
+            k[p][j] = 4 * sinf(half_w) * sinf(half_w);
+            s[p][j] = 0;
+            d[p][j] = 0;
+        }
+    }
+
+    /* Same DC removal and window as window(). */
+    for (i = 0; i < count; i++) {
+        sum += sample_at(samples, narrow, i);
+    }
+    mean = sum / count;
+    float K = -32.0 / (count * count);
+    middle = (float)(count - 1) / 2;
+
+    for (i = 0; i < count; i++) {
+        t = (float)i - middle;
+        float x = fast_expf(K*t*t) *
+            ((float) sample_at(samples, narrow, i) - mean);
+        for (p = 0; p < npeaks; p++) {
+            for (j = 0; j < ZOOM_POINTS; j++) {
+                d[p][j] += x - k[p][j] * s[p][j];
+                s[p][j] += d[p][j];
+            }
+        }
+    }
+
+    for (p = 0; p < npeaks; p++) {
+        float magnitude[ZOOM_POINTS];
+        unsigned int best = 0;
+
+        /* |X|^2 = d^2 + k.s.(s - d) */
+        for (j = 0; j < ZOOM_POINTS; j++) {
+            float sj = s[p][j], dj = d[p][j];
+            magnitude[j] = sqrtf(dj * dj + k[p][j] * sj * (sj - dj));
+            if (magnitude[j] > magnitude[best]) {
+                best = j;
+            }
+        }
+
+        /* Fit to the best point and its neighbours.  If the best
+         * is at the edge, the Gaussian fit can reach a little way
+         * beyond it. */
+        if (best == 0) {
+            best = 1;
+        } else if (best == ZOOM_POINTS - 1) {
+            best = ZOOM_POINTS - 2;
+        }
+        float adjust = gaussian_fit(magnitude[best - 1],
+                                    magnitude[best],
+                                    magnitude[best + 1],
+                                    &peaks[p].magnitude);
+        peaks[p].bucket += ZOOM_SPACING *
+            ((float)best - (ZOOM_POINTS - 1) / 2 + adjust);
+    }
+}
+
+void zoom(const uint16_t *samples,
+          unsigned int count,
+          struct zoom *peaks,
+          unsigned int npeaks)
+{
+    zoom_generic(samples, false, count, peaks, npeaks);
+}
+
+void zoom8(const uint8_t *samples,
+           unsigned int count,
+           struct zoom *peaks,
+           unsigned int npeaks)
+{
+    zoom_generic(samples, true, count, peaks, npeaks);
+}
+
+/* Walk the harmonic comb of the fundamental.  Each harmonic should be
+ * at a whole multiple of the fundamental, but the fundamental is only
+ * known to a fraction of a bucket, and that error grows with each
+ * multiple; so look at the bucket nearest where each one should be
+ * and its neighbours, and fit to whichever is highest. */
+void harmonic_series(const float *magnitudes,
+                     unsigned int count,
+                     float fundamental,
+                     struct series *series)
+{
+    unsigned int n;
+
+    ASSERT(fundamental > 0);
+    for (n = 0; n < SERIES_MAX; n++) {
+        struct zoom *h = &series->harmonic[n];
+        float expected = (n + 1) * fundamental;
+        unsigned int i = expected + 0.5f;
+
+        /* Room for the bucket either side of the best one. */
+        if (i + 2 >= count) {
+            break;
+        }
+        if (i < 2) {
+            i = 2;
+        }
+        if (magnitudes[i - 1] > magnitudes[i]) {
+            i--;
+        } else if (magnitudes[i + 1] > magnitudes[i]) {
+            i++;
+        }
+
+        if (magnitudes[i] > magnitudes[i - 1] &&
+            magnitudes[i] > magnitudes[i + 1] &&
+            magnitudes[i - 1] > 0 && magnitudes[i + 1] > 0) {
+            h->bucket = i + gaussian_fit(magnitudes[i - 1],
+                                         magnitudes[i],
+                                         magnitudes[i + 1],
+                                         &h->magnitude);
+        } else {
+            /* Nothing there but the noise. */
+            h->bucket = expected;
+            h->magnitude = magnitudes[(unsigned int)(expected + 0.5f)];
+        }
+    }
+    series->count = n;
+}
+
 /* Convert complex numbers from cartesian to polar coordinates. */
 void make_polar(const float *real,
                 const float *imag,
@@ -105,8 +365,133 @@ void make_polar(const float *real,
 {
     unsigned int n;
     for (n = 0; n < count; n++) {
-        double r = real[n], i = imag[n];
-        abs[n] = sqrt(r * r + i * i);
-        angle[n] = atan2(i, r);
+        float r = real[n], i = imag[n];
+        abs[n] = fast_sqrtf(r * r + i * i);
+        angle[n] = fast_atan2f(i, r);
+    }
+}
+
+/* Fold every complete cycle of @period samples (8-bit if @narrow)
+ * into one average cycle, with the lowest and highest samples seen at
+ * each phase.  Returns false if there isn't even one complete cycle. */
+static bool fold_generic(const void *samples,
+                         bool narrow,
+                         unsigned int count,
+                         float period,
+                         struct cycle *cycle)
+{
+    uint32_t sum[FOLD_BINS] = { 0 };
+    uint16_t hits[FOLD_BINS] = { 0 };
+    unsigned int i, bin, used, last;
+
+    cycle->cycles = count / period;
+    if (cycle->cycles == 0) {
+        return false;
     }
+    used = cycle->cycles * period;
+    for (bin = 0; bin < FOLD_BINS; bin++) {
+        cycle->min[bin] = 0xffff;
+        cycle->max[bin] = 0;
+    }
+
+    /* Walk the samples once, tracking each one's phase within its
+     * cycle as a 16.16 fixed-point bin number.  The period is rarely
+     * a whole number of samples, so successive cycles land on
+     * slightly different bins and between them fill in the cycle
+     * at a finer resolution than any one of them is sampled at. */
+    uint32_t phase = 0;
+    uint32_t step = roundf(FOLD_BINS * 65536.0f / period);
+    for (i = 0; i < used; i++) {
+        uint16_t s = sample_at(samples, narrow, i);
+        bin = phase >> 16;
+        sum[bin] += s;
+        hits[bin]++;
+        cycle->min[bin] = (s < cycle->min[bin]) ? s : cycle->min[bin];
+        cycle->max[bin] = (s > cycle->max[bin]) ? s : cycle->max[bin];
+        phase += step;
+        if (phase >= (FOLD_BINS << 16)) {
+            phase -= (FOLD_BINS << 16);
+        }
+    }
+
+    /* Average each bin. */
+    last = FOLD_BINS;
+    for (bin = 0; bin < FOLD_BINS; bin++) {
+        if (hits[bin]) {
+            cycle->mean[bin] = (sum[bin] + hits[bin] / 2) / hits[bin];
+            last = bin;
+        }
+    }
+
+    /* With very short periods some bins may never have been hit:
+     * fill those in by interpolating between their neighbours,
+     * remembering that the cycle wraps around. */
+    ASSERT(last < FOLD_BINS);
+    for (bin = 0; bin < FOLD_BINS; bin++) {
+        if (!hits[bin]) {
+            continue;
+        }
+        unsigned int gap = (bin + FOLD_BINS - last) % FOLD_BINS;
+        if (gap == 0) {
+            /* Only one bin was hit: spread it all the way round. */
+            gap = FOLD_BINS;
+        }
+        for (unsigned int j = 1; j < gap; j++) {
+            unsigned int k = (last + j) % FOLD_BINS;
+            cycle->mean[k] = (cycle->mean[last] * (gap - j) +
+                              cycle->mean[bin] * j) / gap;
+            cycle->min[k] = cycle->mean[k];
+            cycle->max[k] = cycle->mean[k];
+        }
+        last = bin;
+    }
+
+    return true;
+}
+
+/* Fold every complete cycle of @period samples into one average
+ * cycle, with the lowest and highest samples seen at each phase.
+ * Returns false if there isn't even one complete cycle. */
+bool fold_cycles(const uint16_t *samples,
+                 unsigned int count,
+                 float period,
+                 struct cycle *cycle)
+{
+    return fold_generic(samples, false, count, period, cycle);
+}
+
+bool fold_cycles8(const uint8_t *samples,
+                  unsigned int count,
+                  float period,
+                  struct cycle *cycle)
+{
+    return fold_generic(samples, true, count, period, cycle);
+}
+
+/* Calculate the modulation percentage of these samples
+ * (8-bit if @narrow). */
+static int mod_generic(const void *samples, bool narrow, unsigned int count)
+{
+    unsigned int max = 0, min = -1;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float s = sample_at(samples, narrow, i);
+        max = (s > max) ? s : max;
+        min = (s < min) ? s : min;
+    }
+
+    /* N.B. *not* (100 * (max - min) / max), as you might expect. */
+    return (int) roundf(100.0 * (max - min) / (max + min));
+}
+
+/* Calculate the modulation percentage of these samples. */
+int mod_percent(const uint16_t *samples, unsigned int count)
+{
+    return mod_generic(samples, false, count);
+}
+
+int mod_percent8(const uint8_t *samples, unsigned int count)
+{
+    return mod_generic(samples, true, count);
 }
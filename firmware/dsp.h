@@ -3,20 +3,133 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Functions ending in 8 take 8-bit samples from sample8(), and work
+ * on the same 12-bit scale as the others (see sample_at()). */
+
 /* Find the dominant frequency in the FFT. 
  * Returns a *normalized* frequency, in buckets. */
 extern float peak(float *magnitudes, unsigned int count);
 
 /* Convert uint16_t samples to complex floats, windowed for FFT'ing.
- * Returns false on error. */
+ * Returns false if any has SAMPLE_ERROR set (see repair()). */
 extern bool window(const uint16_t *samples,
                    float *real,
                    float *imag,
                    unsigned int count);
 
+/* The same for 8-bit samples from sample8(), which can't fail. */
+extern void window8(const uint8_t *samples,
+                    float *real,
+                    float *imag,
+                    unsigned int count);
+
+/* The same again, taking out DC using the @sum of the samples from
+ * sample() or sample8() instead of making an extra pass to find it.
+ * The sum must be of exactly these @count samples. */
+extern bool window_sum(const uint16_t *samples,
+                       uint32_t sum,
+                       float *real,
+                       float *imag,
+                       unsigned int count);
+extern void window8_sum(const uint8_t *samples,
+                        uint32_t sum,
+                        float *real,
+                        float *imag,
+                        unsigned int count);
+
+/* Longest run of bad samples that repair() will fill in.  At the
+ * default rate that's 16us, much less than a cycle of anything we
+ * can measure, so a straight line across it is close enough. */
+#define REPAIR_MAX_RUN 4u
+
+/* Fill in samples with SAMPLE_ERROR set by drawing a straight line
+ * between the good samples either side, or copying the nearest one
+ * at the ends.  Runs longer than REPAIR_MAX_RUN are left flagged,
+ * so window() will still refuse them.  If @sum isn't NULL it's the
+ * samples' total from sample(), and is corrected to match.
+ * Returns how many bad samples there were, repaired or not. */
+extern unsigned int repair(uint16_t *samples,
+                           unsigned int count,
+                           uint32_t *sum);
+
+/* Frequencies per zoomed-in peak, how far apart they are (in
+ * buckets), and how many peaks we can zoom in on at once. */
+#define ZOOM_POINTS 5u
+#define ZOOM_SPACING 0.25f
+#define ZOOM_MAX_PEAKS 4u
+
+/* A peak in the spectrum, in FFT buckets. */
+struct zoom {
+    float bucket;
+    float magnitude;
+};
+
+/* Look more closely at the spectrum of @samples around some peaks.
+ * On entry peaks[].bucket are first guesses at their positions; on
+ * exit they're much more precise, and peaks[].magnitude is filled in
+ * on the same scale as make_polar().  Costs ZOOM_POINTS Goertzel
+ * filter steps per peak per sample. */
+extern void zoom(const uint16_t *samples,
+                 unsigned int count,
+                 struct zoom *peaks,
+                 unsigned int npeaks);
+extern void zoom8(const uint8_t *samples,
+                  unsigned int count,
+                  struct zoom *peaks,
+                  unsigned int npeaks);
+
+/* Most harmonics harmonic_series() looks for, counting the
+ * fundamental. */
+#define SERIES_MAX 16u
+
+/* A fundamental and its harmonics, in FFT buckets, with magnitudes
+ * on the same scale as make_polar(). */
+struct series {
+    unsigned int count;     /* Harmonics found, including the first. */
+    struct zoom harmonic[SERIES_MAX];
+};
+
+/* Walk the harmonic comb of the @fundamental (in buckets, from peak()
+ * or zoom()) through @count make_polar() magnitudes, and fit a
+ * Gaussian to each harmonic as peak() does.  Only looks at the few
+ * buckets around each harmonic, up to SERIES_MAX of them or the end
+ * of the spectrum.  A harmonic with no peak of its own gets the
+ * magnitude at its expected bucket. */
+extern void harmonic_series(const float *magnitudes,
+                            unsigned int count,
+                            float fundamental,
+                            struct series *series);
+
 /* Convert complex numbers from cartesian to polar coordinates. */
 extern void make_polar(const float *real,
                        const float *imag,
                        float *abs,
                        float *angle,
                        unsigned int count);
+
+/* Phase resolution of a folded cycle. */
+#define FOLD_BINS 128u
+
+/* One cycle of a periodic waveform, averaged over many. */
+struct cycle {
+    unsigned int cycles;    /* How many complete cycles went into it. */
+    uint16_t mean[FOLD_BINS];
+    uint16_t min[FOLD_BINS];
+    uint16_t max[FOLD_BINS];
+};
+
+/* Fold every complete cycle of @period samples into one average
+ * cycle, with the lowest and highest samples seen at each phase.
+ * Returns false if there isn't even one complete cycle. */
+extern bool fold_cycles(const uint16_t *samples,
+                        unsigned int count,
+                        float period,
+                        struct cycle *cycle);
+extern bool fold_cycles8(const uint8_t *samples,
+                         unsigned int count,
+                         float period,
+                         struct cycle *cycle);
+
+/* Calculate the modulation percentage of these samples. */
+extern int mod_percent(const uint16_t *samples, unsigned int count);
+extern int mod_percent8(const uint8_t *samples, unsigned int count);
@@ -0,0 +1,195 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "assertions.h"
+#include "event.h"
+#include "sample.h"
+
+/* The running mean is an exponential average over roughly
+ * 2^MEAN_SHIFT samples: 16ms at 250kHz, enough to smooth out
+ * ordinary 100Hz ripple without hiding a sudden change. */
+#define MEAN_SHIFT 12
+
+/* The ring we're streaming into. */
+static uint16_t *ring;
+static uint32_t ring_length;
+
+/* What we're looking for, and how much to keep. */
+static struct event_trigger trigger;
+static unsigned int pre, post;
+
+/* Progress, counted in samples since we armed. */
+static bool armed, triggered;
+static uint32_t checked;
+static uint32_t warmup;
+static uint32_t fired;
+
+/* The running mean, scaled up by 2^MEAN_SHIFT. */
+static uint32_t mean;
+static bool mean_valid;
+
+/* What fired the trigger. */
+static struct event caught;
+
+/* Start streaming samples and watching for @trigger. */
+void event_arm(uint16_t *buffer,
+               unsigned int bits,
+               float hz,
+               const struct event_trigger *t,
+               unsigned int before,
+               unsigned int after)
+{
+    ASSERT(!armed);
+    ASSERT(after > 0);
+    /* Separately, so huge values can't wrap round to small ones. */
+    ASSERT(before <= (1u << bits) - EVENT_SLACK);
+    ASSERT(after <= (1u << bits) - EVENT_SLACK - before);
+
+    ring = buffer;
+    ring_length = 1u << bits;
+    trigger = *t;
+    pre = before;
+    post = after;
+    triggered = false;
+    memset(&caught, 0, sizeof caught);
+    checked = 0;
+    mean_valid = false;
+
+    /* Don't fire until we have a full pre-trigger window, and
+     * (if we're using it) a settled mean. */
+    warmup = pre;
+    if (trigger.deviation && warmup < (1u << MEAN_SHIFT)) {
+        warmup = 1u << MEAN_SHIFT;
+    }
+
+    armed = true;
+    sample_ring_start(hz, ring, bits);
+}
+
+/* Check one sample against the trigger conditions.
+ * Returns the reason it fired, or NULL. */
+static inline const char *check(unsigned int s, unsigned int m)
+{
+    if (trigger.high && s > trigger.high) {
+        return "high";
+    }
+    if (trigger.low && s < trigger.low) {
+        return "low";
+    }
+    if (trigger.deviation) {
+        unsigned int d = (s > m) ? s - m : m - s;
+        if (d > trigger.deviation) {
+            return "deviation";
+        }
+    }
+    return NULL;
+}
+
+/* Reverse @count samples of the ring starting at @from. */
+static void reverse(unsigned int from, unsigned int count)
+{
+    for (unsigned int i = from, j = from + count - 1; i < j; i++, j--) {
+        uint16_t t = ring[i];
+        ring[i] = ring[j];
+        ring[j] = t;
+    }
+}
+
+/* Check the samples that have arrived since the last call. */
+bool event_poll(struct event *event)
+{
+    uint32_t arrived, start;
+    unsigned int rotate;
+
+    ASSERT(armed);
+    arrived = sample_ring_count();
+
+    /* If the ring lapped us, we've no idea what went by, and what's
+     * in the ring isn't where our count says it is. */
+    if (sample_ring_lapped()) {
+        sample_ring_stop();
+        armed = false;
+        caught.lost = "samples went by unchecked";
+        caught.length = 0;
+        caught.trigger = 0;
+        *event = caught;
+        return true;
+    }
+
+    /* This loop has to keep up with the ADC, so it does the least
+     * it can: a couple of compares and a shift-and-add per sample. */
+    while (!triggered && checked != arrived) {
+        unsigned int s = ring[checked & (ring_length - 1)];
+        if (s & SAMPLE_ERROR) {
+            checked++;
+            continue;
+        }
+        if (!mean_valid) {
+            mean = s << MEAN_SHIFT;
+            mean_valid = true;
+        }
+        unsigned int m = mean >> MEAN_SHIFT;
+        if (checked >= warmup) {
+            const char *reason = check(s, m);
+            if (reason) {
+                triggered = true;
+                fired = checked;
+                caught.reason = reason;
+                caught.level = s;
+                caught.mean = m;
+            }
+        }
+        mean += s - m;
+        checked++;
+    }
+
+    if (!triggered || arrived - fired < post) {
+        return false;
+    }
+
+    /* Got it.  Stop, and see how far the DMA got while we did. */
+    sample_ring_stop();
+    armed = false;
+    arrived = sample_ring_count();
+
+    /* If we weren't polled for a whole lap of the ring after the
+     * trigger, the trigger itself has been overwritten: the event is
+     * lost, and there's no window to keep. */
+    if (arrived - fired > ring_length) {
+        caught.lost = "overwritten before it could be kept";
+        caught.length = 0;
+        caught.trigger = 0;
+        *event = caught;
+        return true;
+    }
+
+    /* Trim the pre-trigger part if it's been overwritten. */
+    start = fired - pre;
+    if (arrived - start > ring_length) {
+        start = arrived - ring_length;
+    }
+    caught.length = fired + post - start;
+    caught.trigger = fired - start;
+
+    /* Rotate the ring so the window starts at the beginning. */
+    rotate = start & (ring_length - 1);
+    if (rotate) {
+        reverse(0, rotate);
+        reverse(rotate, ring_length - rotate);
+        reverse(0, ring_length);
+    }
+
+    *event = caught;
+    return true;
+}
+
+/* Stop watching for events. */
+void event_disarm(void)
+{
+    if (armed) {
+        sample_ring_stop();
+        armed = false;
+    }
+}
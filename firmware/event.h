@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The ring must have this much room to spare beyond the window,
+ * for samples that arrive while we're stopping. */
+#define EVENT_SLACK 64u
+
+/* What counts as an event.  Zero turns a condition off. */
+struct event_trigger {
+    unsigned int high;      /* A sample above this level. */
+    unsigned int low;       /* A sample below this level. */
+    unsigned int deviation; /* A sample this far from the running mean. */
+};
+
+/* What we caught. */
+struct event {
+    const char *reason;     /* Which condition fired. */
+    unsigned int level;     /* The sample that fired it. */
+    unsigned int mean;      /* The running mean just before it. */
+    const char *lost;       /* Why we lost it, or NULL if we didn't. */
+    unsigned int length;    /* Samples in the frozen window, 0 if lost. */
+    unsigned int trigger;   /* Where the trigger is in the window. */
+};
+
+/* Start streaming samples at @hz Hz into @ring (2^@bits uint16_ts,
+ * aligned to its size) and watching for @trigger.  When it fires we
+ * keep @pre samples from before the trigger and @post from after. */
+extern void event_arm(uint16_t *ring,
+                      unsigned int bits,
+                      float hz,
+                      const struct event_trigger *trigger,
+                      unsigned int pre,
+                      unsigned int post);
+
+/* Check the samples that have arrived since the last call.  Must be
+ * called more often than the ring fills up.  Once the event has been
+ * captured, stops sampling, moves the window to the start of the ring,
+ * fills in @event and returns true.  If it was called too late, so
+ * that samples went by unchecked or the trigger has already been
+ * overwritten, it stops and returns true with @event->lost saying
+ * why. */
+extern bool event_poll(struct event *event);
+
+/* Stop watching for events. */
+extern void event_disarm(void);
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+# Generate the lookup tables for fastmath.c.
+# Run from this directory: ./fastmath-generator.py > fastmath-tables.h
+
+import math
+
+# Segments per table.  The polynomials are written for this many:
+# change it and the error bounds in fastmath.h need measuring again.
+SEGMENTS = 16
+
+def c_decl(name, values):
+    body = ',\n'.join(f'    {v!r}f' for v in values)
+    return f'static const float {name}[{len(values)}] = {{\n{body}\n}};\n'
+
+print('/* AUTOGENERATED FILE by fastmath-generator.py -- DO NOT EDIT */')
+print()
+
+# log2: the middle of each segment of [1, 2), its reciprocal, and its log.
+centres = [1 + (i + 0.5) / SEGMENTS for i in range(SEGMENTS)]
+print(c_decl('log2_centre', centres))
+print(c_decl('log2_recip', [1 / c for c in centres]))
+print(c_decl('log2_value', [math.log2(c) for c in centres]))
+
+# exp2: 2^x at the start of each segment of [0, 1).
+print(c_decl('exp2_value', [2 ** (i / SEGMENTS) for i in range(SEGMENTS)]))
+
+# sqrt: starting guesses for 1/sqrt(m) in the middle of each
+# segment of [1, 2), then of [2, 4).
+print(c_decl('rsqrt_seed',
+             [1 / math.sqrt(c) for c in centres] +
+             [1 / math.sqrt(2 * c) for c in centres]))
+
+# atan: Taylor series coefficients about the middle of each segment
+# of [0, 1].  atan(c + d) = atan(c) + d/(1 + c^2) - c.d^2/(1 + c^2)^2
+#                            + (3c^2 - 1).d^3/(3(1 + c^2)^3) + ...
+centres = [(i + 0.5) / SEGMENTS for i in range(SEGMENTS)]
+print(c_decl('atan_centre', centres))
+print(c_decl('atan_c0', [math.atan(c) for c in centres]))
+print(c_decl('atan_c1', [1 / (1 + c * c) for c in centres]))
+print(c_decl('atan_c2', [-c / (1 + c * c) ** 2 for c in centres]))
+print(c_decl('atan_c3', [(3 * c * c - 1) / (3 * (1 + c * c) ** 3)
+                         for c in centres]), end='')
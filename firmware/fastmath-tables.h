@@ -0,0 +1,207 @@
+/* AUTOGENERATED FILE by fastmath-generator.py -- DO NOT EDIT */
+
+static const float log2_centre[16] = {
+    1.03125f,
+    1.09375f,
+    1.15625f,
+    1.21875f,
+    1.28125f,
+    1.34375f,
+    1.40625f,
+    1.46875f,
+    1.53125f,
+    1.59375f,
+    1.65625f,
+    1.71875f,
+    1.78125f,
+    1.84375f,
+    1.90625f,
+    1.96875f
+};
+
+static const float log2_recip[16] = {
+    0.9696969696969697f,
+    0.9142857142857143f,
+    0.8648648648648649f,
+    0.8205128205128205f,
+    0.7804878048780488f,
+    0.7441860465116279f,
+    0.7111111111111111f,
+    0.6808510638297872f,
+    0.6530612244897959f,
+    0.6274509803921569f,
+    0.6037735849056604f,
+    0.5818181818181818f,
+    0.5614035087719298f,
+    0.5423728813559322f,
+    0.5245901639344263f,
+    0.5079365079365079f
+};
+
+static const float log2_value[16] = {
+    0.044394119358453436f,
+    0.12928301694496647f,
+    0.20945336562894978f,
+    0.28540221886224837f,
+    0.3575520046180837f,
+    0.42626475470209796f,
+    0.4918530963296747f,
+    0.5545888516776374f,
+    0.6147098441152082f,
+    0.6724253419714956f,
+    0.7279204545631992f,
+    0.7813597135246596f,
+    0.8328900141647416f,
+    0.8826430493618412f,
+    0.9307373375628862f,
+    0.9772799234999164f
+};
+
+static const float exp2_value[16] = {
+    1.0f,
+    1.0442737824274138f,
+    1.0905077326652577f,
+    1.1387886347566916f,
+    1.189207115002721f,
+    1.241857812073484f,
+    1.2968395546510096f,
+    1.3542555469368927f,
+    1.4142135623730951f,
+    1.4768261459394993f,
+    1.5422108254079407f,
+    1.6104903319492543f,
+    1.681792830507429f,
+    1.7562521603732995f,
+    1.8340080864093424f,
+    1.9152065613971474f
+};
+
+static const float rsqrt_seed[32] = {
+    0.9847319278346618f,
+    0.9561828874675149f,
+    0.9299811099505543f,
+    0.9058216273156765f,
+    0.8834522085987723f,
+    0.8626621856275073f,
+    0.8432740427115678f,
+    0.8251369970070347f,
+    0.8081220356417685f,
+    0.7921180343813395f,
+    0.7770286898858113f,
+    0.7627700713964739f,
+    0.7492686492653552f,
+    0.7364596943186588f,
+    0.7242859683401482f,
+    0.7126966450997984f,
+    0.6963106238227914f,
+    0.6761234037828132f,
+    0.6575959492214292f,
+    0.6405126152203485f,
+    0.6246950475544243f,
+    0.6099942813304187f,
+    0.5962847939999439f,
+    0.5834599659915782f,
+    0.5714285714285714f,
+    0.5601120336112039f,
+    0.5494422557947561f,
+    0.5393598899705937f,
+    0.5298129428260175f,
+    0.5207556439232955f,
+    0.5121475197315839f,
+    0.5039526306789696f
+};
+
+static const float atan_centre[16] = {
+    0.03125f,
+    0.09375f,
+    0.15625f,
+    0.21875f,
+    0.28125f,
+    0.34375f,
+    0.40625f,
+    0.46875f,
+    0.53125f,
+    0.59375f,
+    0.65625f,
+    0.71875f,
+    0.78125f,
+    0.84375f,
+    0.90625f,
+    0.96875f
+};
+
+static const float atan_c0[16] = {
+    0.031239833430268277f,
+    0.09347678115858947f,
+    0.15499674192394097f,
+    0.21535769969773805f,
+    0.2741674511196588f,
+    0.3310960767041321f,
+    0.38588266939807375f,
+    0.43833655985795783f,
+    0.48833395105640554f,
+    0.5358112379604637f,
+    0.5807563535676704f,
+    0.6231993299340659f,
+    0.6632029927060933f,
+    0.7008544078844502f,
+    0.7362574289814281f,
+    0.7695264804056583f
+};
+
+static const float atan_c1[16] = {
+    0.9990243902439024f,
+    0.9912875121006777f,
+    0.9761677788369876f,
+    0.9543336439888164f,
+    0.9266968325791856f,
+    0.8943231441048035f,
+    0.8583403185247276f,
+    0.8198558847077662f,
+    0.7798933739527799f,
+    0.7393501805054151f,
+    0.6989761092150171f,
+    0.6593689632968448f,
+    0.6209824135839903f,
+    0.5841414717626925f,
+    0.5490616621983915f,
+    0.5158690176322418f
+};
+
+static const float atan_c2[16] = {
+    -0.031189054134443783f,
+    -0.09212352484188292f,
+    -0.14889117694367782f,
+    -0.19922715401071284f,
+    -0.24152822423783296f,
+    -0.27493602334051603f,
+    -0.2993039166020844f,
+    -0.31507672110466595f,
+    -0.32312413970320814f,
+    -0.3245667218392003f,
+    -0.32062248832251977f,
+    -0.3124890901393933f,
+    -0.3012649671723422f,
+    -0.28790543730916507f,
+    -0.2732060174370548f,
+    -0.2578045669980775f
+};
+
+static const float atan_c3[16] = {
+    -0.3313849680261942f,
+    -0.31613519808061014f,
+    -0.28735476717035957f,
+    -0.24812989172132627f,
+    -0.20232188302838686f,
+    -0.15390887298395117f,
+    -0.10642603211608065f,
+    -0.06260611727242966f,
+    -0.024242875586053755f,
+    0.007762137828012036f,
+    0.033238159903243615f,
+    0.05253789717845134f,
+    0.06633553738457426f,
+    0.0754592744353446f,
+    0.08076882835302854f,
+    0.08307617931032006f
+};
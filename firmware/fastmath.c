@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fastmath.h"
+
+/* The M0+ has no floating point hardware, and the double-precision
+ * library functions are particularly slow.  These each reduce their
+ * argument to a small range, look up the nearest of 16 points in a
+ * table and finish off with a short polynomial: all single-precision
+ * adds and multiplies, and one divide for atan2.
+ * The tables come from fastmath-generator.py. */
+
+#include "fastmath-tables.h"
+
+#define SEGMENTS 16u
+
+/* Get at the bits of a float.  Safe because we've turned off
+ * strict aliasing. */
+union bits {
+    float f;
+    uint32_t u;
+};
+
+#define EXPONENT_SHIFT 23
+#define EXPONENT_BIAS 127
+#define MANTISSA_MASK 0x007fffffu
+#define ONE_BITS 0x3f800000u
+
+/* Coefficients of the Taylor series for log2(1 + r) and 2^g. */
+#define LN2 0.693147180559945f
+#define LOG2_1 (1 / LN2)
+#define LOG2_2 (-1 / (2 * LN2))
+#define LOG2_3 (1 / (3 * LN2))
+#define EXP2_1 LN2
+#define EXP2_2 (LN2 * LN2 / 2)
+#define EXP2_3 (LN2 * LN2 * LN2 / 6)
+
+#define LOG2_E 1.44269504088896f
+
+float fast_log2f(float x)
+{
+    union bits v = { .f = x };
+    int exponent = (int)(v.u >> EXPONENT_SHIFT) - EXPONENT_BIAS;
+    unsigned int i = (v.u >> (EXPONENT_SHIFT - 4)) & (SEGMENTS - 1);
+
+    /* x = m.2^exponent with m in [1, 2), and m is within 1/32 of the
+     * middle of segment i.  Take r = m/c - 1, which is within 1/33
+     * of 0, so log2(m) = log2(c) + log2(1 + r). */
+    v.u = (v.u & MANTISSA_MASK) | ONE_BITS;
+    float r = (v.f - log2_centre[i]) * log2_recip[i];
+    return exponent + log2_value[i] + r * (LOG2_1 + r * (LOG2_2 + r * LOG2_3));
+}
+
+float fast_exp2f(float x)
+{
+    union bits v;
+
+    if (x < 1 - EXPONENT_BIAS) {
+        return 0;
+    }
+    if (x >= EXPONENT_BIAS + 1) {
+        return INFINITY;
+    }
+
+    /* x = n + i/16 + g with g in [0, 1/16), so
+     * 2^x = 2^n . 2^(i/16) . 2^g */
+    int n = (int) x;
+    if (x < n) {
+        n--;
+    }
+    float f = x - n;
+    unsigned int i = f * SEGMENTS;
+    float g = f - (float) i / SEGMENTS;
+    v.f = exp2_value[i] * (1 + g * (EXP2_1 + g * (EXP2_2 + g * EXP2_3)));
+
+    /* That's in [1, 2), so we can put 2^n straight into the exponent. */
+    v.u += (uint32_t) n << EXPONENT_SHIFT;
+    return v.f;
+}
+
+float fast_expf(float x)
+{
+    return fast_exp2f(x * LOG2_E);
+}
+
+float fast_sqrtf(float x)
+{
+    union bits v = { .f = x };
+
+    if (x <= 0) {
+        return 0;
+    }
+
+    /* x = m.2^exponent; make the exponent even, with m in [1, 4). */
+    int exponent = (int)(v.u >> EXPONENT_SHIFT) - EXPONENT_BIAS;
+    unsigned int i = (v.u >> (EXPONENT_SHIFT - 4)) & (SEGMENTS - 1);
+    v.u = (v.u & MANTISSA_MASK) | ONE_BITS;
+    float m = v.f;
+    if (exponent & 1) {
+        m *= 2;
+        i += SEGMENTS;
+        exponent--;
+    }
+
+    /* Start within 1.6% of 1/sqrt(m), and refine it with two
+     * Newton-Raphson steps; unlike the steps for sqrt itself,
+     * these don't need any division. */
+    float y = rsqrt_seed[i];
+    y = y * (1.5f - 0.5f * m * y * y);
+    y = y * (1.5f - 0.5f * m * y * y);
+
+    v.f = m * y;
+    v.u += (uint32_t)(exponent / 2) << EXPONENT_SHIFT;
+    return v.f;
+}
+
+float fast_atan2f(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y), a, t;
+    bool steep = ay > ax;
+
+    if (ax == 0 && ay == 0) {
+        return 0;
+    }
+
+    /* Work out the angle in the first octant, then reflect it. */
+    a = steep ? ax / ay : ay / ax;
+    unsigned int i = a * SEGMENTS;
+    if (i >= SEGMENTS) {
+        i = SEGMENTS - 1;
+    }
+    float d = a - atan_centre[i];
+    t = atan_c0[i] + d * (atan_c1[i] + d * (atan_c2[i] + d * atan_c3[i]));
+
+    if (steep) {
+        t = (float) M_PI_2 - t;
+    }
+    if (x < 0) {
+        t = (float) M_PI - t;
+    }
+    return (y < 0) ? -t : t;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+/* Fast single-precision approximations to the maths library.
+ * Arguments must be finite, and normal where they're not zero:
+ * none of these bother with denormals, infinities or NaNs. */
+
+/* log2(x) for x > 0.  Error at most 4e-7, or 4e-7 of the result
+ * if that's bigger than 1. */
+extern float fast_log2f(float x);
+
+/* 2^x and e^x.  Relative error at most 3e-7; for e^x, that's
+ * multiplied by |x| if it's more than 1, from rounding x.log2(e).
+ * Underflow gives 0 and overflow gives INFINITY. */
+extern float fast_exp2f(float x);
+extern float fast_expf(float x);
+
+/* sqrt(x) for x >= 0.  Relative error at most 4e-7. */
+extern float fast_sqrtf(float x);
+
+/* atan2(y, x).  Error at most 5e-7 radians.
+ * Returns 0 when both are 0. */
+extern float fast_atan2f(float y, float x);
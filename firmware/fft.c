@@ -35,10 +35,19 @@ static void bit_reverse_shuffle(float *samples, unsigned int N)
 /* In-place radix-2 time-decimation FFT.
  * Input/output array length must must be a power of 2. */
 void fft(float *real, float *imag, unsigned int length)
+{
+    fft_pruned(real, imag, length, length);
+}
+
+/* In-place radix-2 time-decimation FFT that only produces outputs
+ * below @max_bin.  Entries from @max_bin up are left as garbage. */
+void fft_pruned(float *real, float *imag, unsigned int length,
+                unsigned int max_bin)
 {
     /* Length must be 2^N. */
     ASSERT(length != 0);
     ASSERT((length & (length - 1)) == 0);
+    ASSERT(max_bin > 0 && max_bin <= length);
     /* Find N, which is the bit-width of our array offsets. */
     unsigned int N = __builtin_ctz(length);
 
@@ -60,6 +69,18 @@ void fft(float *real, float *imag, unsigned int length)
     bit_reverse_shuffle(imag, N);
 
     for (unsigned int sub_length = 2; sub_length <= length; sub_length *= 2) {
+        /* Pruning: output k of each sub-DFT only feeds outputs k and
+         * k + sub_length of the next stage up, so if we only want
+         * the final outputs below max_bin we only need outputs below
+         * max_bin from every stage.  The butterfly at 'step' makes
+         * outputs 'step' (A) and 'step + half' (B); in the last few
+         * stages, where sub_length > max_bin, we can skip the
+         * butterflies where neither is wanted and the B half of
+         * those where only A is.  The earlier stages are untouched. */
+        unsigned int half = sub_length / 2;
+        unsigned int wanted = (max_bin < sub_length) ? max_bin : sub_length;
+        unsigned int steps = (wanted < half) ? wanted : half;
+
         /* In this pass we are merging smaller DFTs into DFTs
          * of length sub_length.  This should look like:
          * for (base = 0; base < length; base += sub_length):
@@ -68,17 +89,31 @@ void fft(float *real, float *imag, unsigned int length)
          *         merge [base+step] with [base+(sub_length/2)+step]
          * but calculating twiddle factors is expensive so 
          * we invert the inner two loops so we can reuse them. */
-        for (unsigned int step = 0; step < sub_length / 2; step++) {
+        for (unsigned int step = 0; step < steps; step++) {
             /* Calculate "twiddle factor" e^(-2*pi*i*step/sub_length). */
             float twiddle_angle = -(float)M_TWOPI * step / sub_length;
             float twiddle_sin, twiddle_cos;
             sincosf(twiddle_angle, &twiddle_sin, &twiddle_cos);
+
+            if (step + half >= wanted) {
+                /* Only the A output is wanted. */
+                for (unsigned int base = 0; base < length; base += sub_length) {
+                    unsigned int A_index = base + step;
+                    unsigned int B_index = A_index + half;
+                    float B_real = real[B_index];
+                    float B_imag = imag[B_index];
+                    real[A_index] += B_real * twiddle_cos - B_imag * twiddle_sin;
+                    imag[A_index] += B_imag * twiddle_cos + B_real * twiddle_sin;
+                }
+                continue;
+            }
+
             for (unsigned int base = 0; base < length; base += sub_length) {
                 /* Load the two entries that we're going to merge. */
                 unsigned int A_index = base + step;
                 float A_real = real[A_index];
                 float A_imag = imag[A_index];
-                unsigned int B_index = A_index + (sub_length / 2);
+                unsigned int B_index = A_index + half;
                 float B_real = real[B_index];
                 float B_imag = imag[B_index];
                 /* Butterfly.  This is equivalent to taking
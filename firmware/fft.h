@@ -3,3 +3,9 @@
 /* In-place radix-2 time-decimation FFT.
  * Input/output array length must must be a power of 2. */
 extern void fft(float *real, float *imag, unsigned int length);
+
+/* In-place radix-2 time-decimation FFT that only produces outputs
+ * below @max_bin, skipping the butterflies that would only feed
+ * the rest.  Entries from @max_bin up are left as garbage. */
+extern void fft_pruned(float *real, float *imag, unsigned int length,
+                       unsigned int max_bin);
@@ -1,39 +1,44 @@
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "assertions.h"
+#include "fastmath.h"
 #include "graph.h"
+#include "sample.h"
 
 /* We plot into a small framebuffer.
  * Frame bits are left to right, top to bottom.
- * That might change when we have an actual display. */
-#define WIDTH 80u
-#define HEIGHT 20u
-static uint8_t frame[WIDTH * HEIGHT / 8];
+ * display.c copies them into the panel's own layout. */
+#define WIDTH GRAPH_WIDTH
+#define HEIGHT GRAPH_HEIGHT
+
+/* Frame for graph() and graph_logx(), which print straight away. */
+static uint8_t scratch[GRAPH_BYTES];
 
 /* Cursor */
 static unsigned int cx, cy;
 
 /* Set a pixel at these coordinates. */
-static void set_pixel(unsigned int x, unsigned int y)
+static void set_pixel(uint8_t *frame, unsigned int x, unsigned int y)
 {
     unsigned int bit = (HEIGHT - 1 - y) * WIDTH + x;
     frame[bit / 8] |= 1u << (bit % 8);
 }
 
 /* Move the cursor to (x, y) and set the pixel there. */
-static void skip_to(unsigned int x, unsigned int y)
+static void skip_to(uint8_t *frame, unsigned int x, unsigned int y)
 {
-    set_pixel(x, y);
+    set_pixel(frame, x, y);
     cx = x;
     cy = y;
 }
 
 /* Move the cursor to (x, y), filling in all pixels on the way. */
-static void plot_to(unsigned int x, unsigned int y)
+static void plot_to(uint8_t *frame, unsigned int x, unsigned int y)
 {
     int xrange = x - cx;
     int yrange = y - cy;
@@ -45,7 +50,7 @@ static void plot_to(unsigned int x, unsigned int y)
     for (int i = 1; i <= steps; i++) {
         px = cx + ((xrange * i + steps / 2) / steps);
         py = cy + ((yrange * i + steps / 2) / steps);
-        set_pixel(px, py);
+        set_pixel(frame, px, py);
     }
 
     cx = x;
@@ -61,8 +66,8 @@ static void print_line(void)
     putchar('\n');
 }
 
-/* Print the frame on the serial console. */
-static void print_frame()
+/* Print a frame on the serial console. */
+void graph_print(const uint8_t *frame)
 {
     unsigned int bit, i;
 
@@ -77,42 +82,55 @@ static void print_frame()
     print_line();
 }
 
-/* Graph 16-bit samples on a linear scale. */
-void graph(uint16_t *samples, unsigned int count)
+/* Draw samples (8-bit if @narrow) on a linear scale. */
+static void draw_linear(uint8_t *frame,
+                        const void *samples,
+                        bool narrow,
+                        unsigned int count)
 {
     unsigned int i, x, y;
-    uint16_t max;
+    unsigned int max;
 
     /* Find our Y-axis scale. */
     max = 0;
     for (i = 0; i < count; i++) {
-        if (samples[i] > max) {
-            max = samples[i];
+        if (sample_at(samples, narrow, i) > max) {
+            max = sample_at(samples, narrow, i);
         }
     }
 
     /* Figure out the pixels. */
-    memset(frame, 0, sizeof frame);
+    memset(frame, 0, GRAPH_BYTES);
     for (i = 0; i < count; i++) {
         x = ((uint64_t) i) * WIDTH / count;
-        y = samples[i] * HEIGHT / (max + 1);
+        y = sample_at(samples, narrow, i) * HEIGHT / (max + 1);
         ASSERT(x < WIDTH);
         ASSERT(y < HEIGHT);
         if (i == 0) {
-            skip_to(x, y);
+            skip_to(frame, x, y);
         } else {
-            plot_to(x, y);
+            plot_to(frame, x, y);
         }
     }
+}
 
-    print_frame();
+/* Draw 16-bit samples on a linear scale. */
+void graph_draw(uint8_t *frame, const uint16_t *samples, unsigned int count)
+{
+    draw_linear(frame, samples, false, count);
 }
 
-/* Graph floating-point samples on a log-x/linear-y scale. */
-void graph_logx(float *samples, unsigned int count)
+/* Draw 8-bit samples on a linear scale. */
+void graph_draw8(uint8_t *frame, const uint8_t *samples, unsigned int count)
+{
+    draw_linear(frame, samples, true, count);
+}
+
+/* Draw floating-point samples on a log-x/linear-y scale. */
+void graph_draw_logx(uint8_t *frame, const float *samples, unsigned int count)
 {
     unsigned int i, x, y;
-    float max, log_count;
+    float max, x_scale, y_scale;
 
     /* Find our Y-axis scale. */
     max = 0;
@@ -121,21 +139,35 @@ void graph_logx(float *samples, unsigned int count)
             max = samples[i];
         }
     }
-    log_count = log2f(count);
+    x_scale = (WIDTH - 1) / fast_log2f(count);
+    y_scale = (max > 0) ? (HEIGHT - 1) / max : 0;
 
-    /* Figure out the pixels. */
-    memset(frame, 0, sizeof frame);
+    /* Figure out the pixels.  Everything's positive, so adding
+     * a half and truncating rounds to nearest. */
+    memset(frame, 0, GRAPH_BYTES);
     for (i = 0; i < count; i++) {
-        x = roundf(log2f(i) / log_count * (WIDTH - 1));
-        y = roundf(samples[i] / max * (HEIGHT - 1));
+        x = (i == 0) ? 0 : fast_log2f(i) * x_scale + 0.5f;
+        y = samples[i] * y_scale + 0.5f;
         ASSERT(x < WIDTH);
         ASSERT(y < HEIGHT);
         if (i == 0) {
-            skip_to(x, y);
+            skip_to(frame, x, y);
         } else {
-            plot_to(x, y);
+            plot_to(frame, x, y);
         }
     }
+}
 
-    print_frame();
+/* Graph 16-bit samples on a linear scale. */
+void graph(uint16_t *samples, unsigned int count)
+{
+    graph_draw(scratch, samples, count);
+    graph_print(scratch);
+}
+
+/* Graph floating-point samples on a log-x/linear-y scale. */
+void graph_logx(float *samples, unsigned int count)
+{
+    graph_draw_logx(scratch, samples, count);
+    graph_print(scratch);
 }
@@ -2,6 +2,23 @@
 
 #include <stdint.h>
 
+/* Graphs are drawn into a small 1-bit framebuffer. */
+#define GRAPH_WIDTH 80u
+#define GRAPH_HEIGHT 20u
+#define GRAPH_BYTES (GRAPH_WIDTH * GRAPH_HEIGHT / 8)
+
+/* Draw 16-bit samples on a linear scale. */
+void graph_draw(uint8_t *frame, const uint16_t *samples, unsigned int count);
+
+/* Draw 8-bit samples from sample8() on a linear scale. */
+void graph_draw8(uint8_t *frame, const uint8_t *samples, unsigned int count);
+
+/* Draw floating-point samples on a log-x/linear-y scale. */
+void graph_draw_logx(uint8_t *frame, const float *samples, unsigned int count);
+
+/* Print a frame on the serial console. */
+void graph_print(const uint8_t *frame);
+
 /* Graph 16-bit samples on a linear scale. */
 void graph(uint16_t *samples, unsigned int count);
 
@@ -0,0 +1,303 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "pico/stdlib.h"
+
+#include "assertions.h"
+#include "history.h"
+
+/* The log is a ring of records in whatever flash the firmware doesn't
+ * use.  We write it a page at a time, in order, and erase each sector
+ * just before we reuse it, so every sector gets erased the same number
+ * of times however long the meter runs.  Nothing says where the ring
+ * starts: at boot we look for the highest sequence number and carry on
+ * from the page after it. */
+
+#define RECORDS_PER_PAGE (FLASH_PAGE_SIZE / sizeof (struct history_record))
+#define RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE / sizeof (struct history_record))
+
+/* How long to wait for core1 to get out of the way of a flash write. */
+#define FLASH_TIMEOUT_MS 100
+
+/* Where the linker put the end of the firmware. */
+extern char __flash_binary_end;
+
+/* The log's place in flash, as offsets from the start. */
+static uint32_t start, end;
+static bool ready;
+
+/* The next page we'll program. */
+static uint32_t next;
+
+/* The last sequence number we used, and which power-up this is. */
+static uint32_t sequence;
+static uint16_t boot;
+
+/* Valid records in flash, and flash operations that failed. */
+static unsigned int stored;
+static unsigned int failures;
+
+/* Records waiting to be written. */
+static struct history_record page[RECORDS_PER_PAGE];
+static unsigned int pending;
+
+/* Flash is readable at XIP_BASE. */
+static inline const struct history_record *at(uint32_t offset)
+{
+    return (const struct history_record *)(uintptr_t)(XIP_BASE + offset);
+}
+
+static uint16_t fletcher16(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint16_t a = 0, b = 0;
+    for (size_t i = 0; i < length; i++) {
+        a = (a + bytes[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+static bool valid(const struct history_record *r)
+{
+    return r->sequence != 0xffffffffu &&
+        r->check == fletcher16(r, offsetof(struct history_record, check));
+}
+
+/* Step @offset on by @size, wrapping round the ring. */
+static inline uint32_t advance(uint32_t offset, uint32_t size)
+{
+    offset += size;
+    return (offset >= end) ? start : offset;
+}
+
+/* Find the log in flash and where it got up to. */
+bool history_init(void)
+{
+    uint32_t newest = 0;
+
+    _Static_assert(sizeof (struct history_record) == 32,
+                   "history records should pack neatly into pages");
+
+    start = ((uintptr_t) &__flash_binary_end - XIP_BASE +
+             FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    end = PICO_FLASH_SIZE_BYTES;
+    if (end < start + 2 * FLASH_SECTOR_SIZE) {
+        return false;
+    }
+
+    /* Find the newest record. */
+    sequence = 0;
+    stored = 0;
+    for (uint32_t offset = start; offset < end;
+         offset += sizeof (struct history_record)) {
+        const struct history_record *r = at(offset);
+        if (!valid(r)) {
+            continue;
+        }
+        stored++;
+        if (r->sequence > sequence) {
+            sequence = r->sequence;
+            newest = offset;
+        }
+    }
+
+    if (sequence) {
+        boot = at(newest)->boot + 1;
+        next = advance(newest & ~(FLASH_PAGE_SIZE - 1), FLASH_PAGE_SIZE);
+    } else {
+        boot = 0;
+        next = start;
+    }
+    pending = 0;
+    ready = true;
+    return true;
+}
+
+/* Flash operations, run with core1 and interrupts out of the way. */
+static void erase(void *param)
+{
+    flash_range_erase(*(uint32_t *) param, FLASH_SECTOR_SIZE);
+}
+
+static void program(void *param)
+{
+    flash_range_program(*(uint32_t *) param,
+                        (const uint8_t *) page, FLASH_PAGE_SIZE);
+}
+
+static bool blank(uint32_t offset)
+{
+    const uint32_t *words = (const uint32_t *) at(offset);
+    for (unsigned int i = 0; i < FLASH_PAGE_SIZE / sizeof *words; i++) {
+        if (words[i] != 0xffffffffu) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Program page[] into the next page of the ring. */
+static void write_page(void)
+{
+    /* A page that should be blank but isn't was probably half written
+     * when the power went.  Give up on that sector. */
+    if ((next % FLASH_SECTOR_SIZE) != 0 && !blank(next)) {
+        next = advance(next - (next % FLASH_SECTOR_SIZE), FLASH_SECTOR_SIZE);
+    }
+
+    /* Starting a sector: erase it, losing the oldest records. */
+    if ((next % FLASH_SECTOR_SIZE) == 0) {
+        for (unsigned int i = 0; i < RECORDS_PER_SECTOR; i++) {
+            if (valid(at(next) + i)) {
+                stored--;
+            }
+        }
+        if (flash_safe_execute(erase, &next, FLASH_TIMEOUT_MS) != PICO_OK) {
+            failures++;
+            return;
+        }
+    }
+
+    if (flash_safe_execute(program, &next, FLASH_TIMEOUT_MS) != PICO_OK) {
+        failures++;
+        return;
+    }
+    for (unsigned int i = 0; i < RECORDS_PER_PAGE; i++) {
+        if (valid(&page[i])) {
+            stored++;
+        }
+    }
+    next = advance(next, FLASH_PAGE_SIZE);
+}
+
+/* Boil the spectrum down to the loudest bucket in each band,
+ * relative to the loudest of all. */
+static void summarise(uint8_t *spectrum,
+                      const float *magnitudes,
+                      unsigned int count)
+{
+    float loudest = 0;
+    unsigned int low = 1, high, i;
+
+    /* Bucket 0 is DC, which window() took out. */
+    for (i = 1; i < count; i++) {
+        loudest = fmaxf(loudest, magnitudes[i]);
+    }
+    for (unsigned int b = 0; b < HISTORY_BANDS; b++) {
+        float band = 0;
+        high = roundf(powf(count, (float)(b + 1) / HISTORY_BANDS));
+        if (high <= low) {
+            high = low + 1;
+        }
+        for (i = low; i < high && i < count; i++) {
+            band = fmaxf(band, magnitudes[i]);
+        }
+        float half_dbs = (band > 0) ? 40 * log10f(loudest / band) : 255;
+        spectrum[b] = MIN(roundf(half_dbs), 255);
+        low = high;
+    }
+}
+
+/* Add a measurement to the log. */
+void history_add(const struct report *report,
+                 const float *magnitudes,
+                 unsigned int count)
+{
+    if (!ready) {
+        return;
+    }
+
+    struct history_record *r = &page[pending];
+    r->sequence = ++sequence;
+    r->boot = boot;
+    r->flicker = MIN(MAX(report->flicker, 0), 255);
+    r->agc_level = report->agc_level;
+    r->seconds = to_ms_since_boot(get_absolute_time()) / 1000;
+    r->frequency = (report->harmonics > 0) ? report->harmonic[0].frequency
+                                           : report->frequency;
+    summarise(r->spectrum, magnitudes, count);
+    r->check = fletcher16(r, offsetof(struct history_record, check));
+
+    if (++pending == RECORDS_PER_PAGE) {
+        write_page();
+        pending = 0;
+    }
+}
+
+/* Write out any records still waiting in RAM.  The rest of
+ * their page is left blank. */
+void history_flush(void)
+{
+    if (!ready || pending == 0) {
+        return;
+    }
+    memset(&page[pending], 0xff,
+           (RECORDS_PER_PAGE - pending) * sizeof *page);
+    write_page();
+    pending = 0;
+}
+
+unsigned int history_count(void)
+{
+    return stored + pending;
+}
+
+unsigned int history_capacity(void)
+{
+    if (!ready) {
+        return 0;
+    }
+    /* The sector we're filling doesn't count: the next time round
+     * it'll be erased before it's full. */
+    return (end - start) / FLASH_SECTOR_SIZE * RECORDS_PER_SECTOR -
+        RECORDS_PER_SECTOR;
+}
+
+unsigned int history_failures(void)
+{
+    return failures;
+}
+
+/* Call @each on the newest @count records, oldest first. */
+void history_each(unsigned int count,
+                  void (*each)(const struct history_record *))
+{
+    unsigned int skip, i;
+    uint32_t offset;
+
+    if (!ready) {
+        return;
+    }
+    skip = (history_count() > count) ? history_count() - count : 0;
+
+    /* The page we'll write over next holds the oldest records. */
+    offset = next;
+    do {
+        for (i = 0; i < RECORDS_PER_PAGE; i++) {
+            const struct history_record *r = at(offset) + i;
+            if (!valid(r)) {
+                continue;
+            }
+            if (skip) {
+                skip--;
+            } else {
+                each(r);
+            }
+        }
+        offset = advance(offset, FLASH_PAGE_SIZE);
+    } while (offset != next);
+
+    for (i = 0; i < pending; i++) {
+        if (skip) {
+            skip--;
+        } else {
+            each(&page[i]);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "output.h"
+
+/* Bands in a record's spectrum summary. */
+#define HISTORY_BANDS 14u
+
+/* One measurement, as kept in flash.  32 bytes, so eight to a page. */
+struct history_record {
+    uint32_t sequence;      /* Counts up from 1 forever; ~0 is blank. */
+    uint16_t boot;          /* Which power-up this was made in. */
+    uint8_t flicker;        /* Percent. */
+    uint8_t agc_level;      /* 0 to 127. */
+    uint32_t seconds;       /* Since that power-up. */
+    float frequency;        /* Peak frequency, Hz. */
+    /* Loudest FFT bucket in each of HISTORY_BANDS log-spaced bands,
+     * in half-dBs below the loudest of all, up to 255. */
+    uint8_t spectrum[HISTORY_BANDS];
+    uint16_t check;         /* Fletcher-16 of everything above. */
+};
+
+/* Find the log in flash and where it got up to.
+ * Returns false if there's no room for one after the firmware. */
+extern bool history_init(void);
+
+/* Add a measurement to the log, with the spectrum it came from
+ * (@count buckets of make_polar() magnitudes).  Records are
+ * written to flash a page at a time, so this usually just copies
+ * it into RAM; every so often it takes a millisecond or so to
+ * program a page, and every 128 records it erases a sector too. */
+extern void history_add(const struct report *report,
+                        const float *magnitudes,
+                        unsigned int count);
+
+/* Write out any records still waiting in RAM. */
+extern void history_flush(void);
+
+/* Records we have, including any still waiting in RAM,
+ * and the most the log can hold. */
+extern unsigned int history_count(void);
+extern unsigned int history_capacity(void);
+
+/* Flash writes that couldn't be done, losing a page of records. */
+extern unsigned int history_failures(void);
+
+/* Call @each on the newest @count records (or all of them if there
+ * are fewer), oldest first. */
+extern void history_each(unsigned int count,
+                         void (*each)(const struct history_record *));
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "hardware/gpio.h"
 
@@ -10,52 +11,143 @@
 
 #include "agc.h"
 #include "assertions.h"
+#include "command.h"
+#include "display.h"
 #include "dsp.h"
+#include "event.h"
 #include "fft.h"
 #include "graph.h"
+#include "history.h"
+#include "output.h"
 #include "pins.h"
 #include "sample.h"
 
 /* The phototransistor is (just) able to pick up 110kHz
  * flicker, so we need to sample at least twice as fast.
  * The pico can go to 500kHz but we don't have room to
- * process that much data. */
+ * process that much data.  This is the default; it can be
+ * changed from the console. */
 #define SAMPLE_RATE 250000.0
 
 /* Sample count is limited by our FFT implementation.
  * It uses 8 bytes per sample and only works on powers of two,
  * so use 128kB just for that, and everything else fits in the
  * other half of memory.  That give us 1/16th of a second
- * at our chosen sample rate, i.e. 6.25 cycles of 100Hz. */
+ * at our chosen sample rate, i.e. 6.25 cycles of 100Hz.
+ * Shorter captures can be asked for from the console. */
 #define SAMPLE_COUNT (16u * 1024u)
 
 /* FFT buckets: the FFT produces twice as many but
  * everything above this is just aliasing. */
 #define FREQ_COUNT ((SAMPLE_COUNT / 2u) + 1u)
-#define HZ_PER_BUCKET ((SAMPLE_RATE / 2) / (FREQ_COUNT - 1))
+
+/* Bounds on the settings that can be changed at run time.
+ * The ADC's clock divider is 16 bits, so it can't go much below 1kHz. */
+#define MIN_SAMPLE_RATE 1000u
+#define MAX_SAMPLE_RATE 500000u
+#define MIN_SAMPLE_COUNT 256u
+#define MAX_ERRORS 100000u
+
+/* Measurement settings, adjustable from the console. */
+static struct {
+    float rate;             /* Samples per second. */
+    unsigned int count;     /* Samples per measurement, a power of 2. */
+    float limit;            /* Ignore frequencies above this (Hz). */
+    unsigned int interval;  /* Milliseconds between measurements. */
+    bool continuous;        /* Measure every @interval, or on request? */
+    unsigned int zoom;      /* Harmonics to zoom in on, 0 for none. */
+    unsigned int bits;      /* Sample width: 12, or 8 for twice as many. */
+    unsigned int errors;    /* Bad samples per million we'll repair. */
+    bool track;             /* Follow the last light found? */
+} settings = {
+    .rate = SAMPLE_RATE,
+    .count = SAMPLE_COUNT,
+    /* Ideally we could look all the way to the Nyquist
+     * frequency, but in practice we get a lot of noise
+     * below that.  I can see noise at 130kHz on the 3V3 line
+     * wich ought to show up in our samples aliased at 120kHz;
+     * in our FFTs we see noise centred at about 90kHz too.
+     * For now, limit to 1/4 the sample freq (i.e. 62.5kHz).
+     * It would be nice to make some hardware improvements
+     * here because I know the phototransistor can pick up
+     * 3% flicker at 75kHz. */
+    .limit = SAMPLE_RATE / 4,
+    .interval = 2000,
+    .continuous = true,
+    .zoom = 1,
+    .bits = 12,
+    /* The ADC's errors come singly, now and then, more often on a
+     * noisy supply.  A few in a capture make no visible difference
+     * once they're filled in; lots mean something's really wrong. */
+    .errors = 1000,
+};
+
+/* Set by the 'measure' command. */
+static bool measure_requested;
+
+/* Event capture: while it's armed, or holding a captured event,
+ * it owns the sample buffer and ordinary measurements wait. */
+static enum { EVENT_OFF, EVENT_ARMED, EVENT_CAPTURED } event_state;
+static struct event event;
+
+/* Most samples we can hold at the current width. */
+static inline unsigned int max_count(void)
+{
+    return (settings.bits == 8) ? 2 * SAMPLE_COUNT : SAMPLE_COUNT;
+}
+
+/* 8-bit captures can be longer than the FFT has room for.
+ * Then the FFT just looks at the start of them, and the rest
+ * goes into zooming in and averaging cycles. */
+static inline unsigned int fft_count(void)
+{
+    return MIN(settings.count, SAMPLE_COUNT);
+}
+
+/* FFT bucket conversions for the current settings. */
+static inline unsigned int freq_count(void)
+{
+    return (fft_count() / 2u) + 1u;
+}
+static inline float hz_per_bucket(void)
+{
+    return settings.rate / fft_count();
+}
+static inline float to_bucket_exact(float hz)
+{
+    return hz / hz_per_bucket();
+}
 static inline unsigned int to_bucket(float hz)
 {
-    return roundf(hz / HZ_PER_BUCKET);
+    return roundf(to_bucket_exact(hz));
 }
 static inline float to_frequency(float bucket)
 {
-    return HZ_PER_BUCKET * bucket;
+    return hz_per_bucket() * bucket;
 }
 
-/* FFT bucket above which we ignore things because
- * of noise.  Ideally we could go all the way to
- * FREQ_COUNT, but in practice we get a lot of noise
- * below that.  I can see noise at 130kHz on the 3V3 line
- * wich ought to show up in our samples aliased at 120kHz;
- * in our FFTs we see noise centred at about 90kHz too.
- * For now, limit to 1/4 the sample freq (i.e. 62.5kHz).
- * It would be nice to make some hardware improvements
- * here because I know the phototransistor can pick up
- * 3% flicker at 75kHz. */
- #define FREQ_LIMIT (FREQ_COUNT / 2)
+/* FFT bucket above which we ignore things because of noise. */
+static unsigned int freq_limit(void)
+{
+    unsigned int limit = to_bucket(settings.limit);
+    /* peak() needs at least three buckets to interpolate. */
+    if (limit < 3) {
+        limit = 3;
+    }
+    if (limit > freq_count()) {
+        limit = freq_count();
+    }
+    return limit;
+}
+
+/* Raw 12-bit samples from the ADC.
+ * Aligned so that event capture can use it as a DMA ring. */
+#define SAMPLE_BITS 14u
+static uint16_t samples[SAMPLE_COUNT]
+    __attribute__((aligned(SAMPLE_COUNT * sizeof (uint16_t))));
 
-/* Raw 12-bit samples from the ADC. */
-static uint16_t samples[SAMPLE_COUNT];
+/* The same space holds twice as many 8-bit samples. */
+static uint8_t *const samples8 = (uint8_t *) samples;
 
 /* FFT calculation space.
  * We convert cartesian to polar coordinates in place to save space.
@@ -85,68 +177,650 @@ void assertion_failure(const char *pred, const char *file, int line)
     }
 }
 
-/* Calculate the modulation percentage of these samples. */
-static int mod_percent(uint16_t *samples, unsigned int count)
+/* The harmonic series, in FFT buckets. */
+static struct series series;
+
+/* Averaged waveform, and two copies of it side by side for graphing. */
+static struct cycle cycle;
+static uint16_t two_cycles[2 * FOLD_BINS];
+
+/* What we found, on its way to the output core. */
+static struct report report;
+
+/* Tracking: rather than starting from scratch every time, follow the
+ * light the last full measurement found.  The AGC goes straight back
+ * to where it was, the capture only needs to be long enough to see
+ * the fundamental clearly, and instead of an FFT of the whole band
+ * the Goertzel filters zoom() uses look just around the fundamental
+ * and its harmonics.  If the fundamental isn't where we expected, or
+ * is much louder or quieter, or the light no longer fits the ADC's
+ * range, we've lost it and go back to a full measurement. */
+
+/* Cycles of the fundamental in a tracking capture.  With the Gaussian
+ * window, that keeps both DC and the second harmonic far enough from
+ * the fundamental not to disturb the zoom. */
+#define TRACK_CYCLES 8u
+
+/* How much louder or quieter the fundamental may get from one
+ * measurement to the next before we stop believing it's the same. */
+#define TRACK_LEVEL_RATIO 2.0f
+
+/* Log tracked measurements no more often than this, so a fast update
+ * rate doesn't wear out the flash. */
+#define TRACK_LOG_MS 2000u
+
+static struct {
+    bool locked;            /* Is there anything to follow? */
+    float frequency;        /* Fundamental, Hz. */
+    float level;            /* Its magnitude per sample. */
+    unsigned int agc_level;
+    unsigned int limit;     /* Buckets of f.magnitude still valid. */
+    absolute_time_t next_log;
+} track;
+
+/* Take @count samples, fill in any bad ones and put the AGC back in
+ * a safe state.  Returns false if there were too many errors. */
+static bool capture(unsigned int count, struct sample_stats *stats)
 {
-    unsigned int max = 0, min = -1;
+    bool narrow = (settings.bits == 8);
+
+    /* Collect uint16_t samples in [0, 0xfff], or uint8_t ones
+     * in [0, 0xff]. */
+    if (narrow) {
+        *stats = sample8(count, settings.rate, samples8);
+    } else {
+        *stats = sample(count, settings.rate, samples);
+    }
+
+    /* Put the AGC back in a known safe state. */
+    agc_reset();
 
-    for (unsigned int i = 0; i < count; i++)
-    {
-        float s = samples[i];
-        max = (s > max) ? s : max;
-        min = (s < min) ? s : min;
+    /* Fill in the odd bad sample rather than throw the whole capture
+     * away, unless there are too many to trust the rest.  8-bit
+     * samples have no room to say which ones were bad, so the best
+     * we can do with those is carry on. */
+    report.errors = 0;
+    if (stats->errors && !narrow) {
+        report.errors = repair(samples, count, &stats->sum);
+        if ((uint64_t) report.errors * 1000000u >
+            (uint64_t) settings.errors * count) {
+            output_text("Sampling errors: %u of %u samples bad.\n",
+                        report.errors, count);
+            return false;
+        }
     }
+    return true;
+}
+
+/* Fill in the waveform part of the report from @count samples of
+ * a light at @frequency Hz. */
+static void waveform(unsigned int count, float frequency)
+{
+    bool narrow = (settings.bits == 8);
+    float period;
 
-    /* N.B. *not* (100 * (max - min) / max), as you might expect. */
-    return (int) roundf(100.0 * (max - min) / (max + min));
+    /* Look at a couple of cycles of the waveform.  Average all the
+     * cycles we caught if we can: it's much less noisy than any one. */
+    period = settings.rate / frequency;
+    if (narrow ? fold_cycles8(samples8, count, period, &cycle) :
+                 fold_cycles(samples, count, period, &cycle)) {
+        memcpy(two_cycles, cycle.mean, sizeof cycle.mean);
+        memcpy(two_cycles + FOLD_BINS, cycle.mean, sizeof cycle.mean);
+        graph_draw(report.waveform, two_cycles, 2 * FOLD_BINS);
+        report.flicker = mod_percent(cycle.mean, FOLD_BINS);
+        /* The envelope shows how much individual cycles stray
+         * from the average, whether from noise or real jitter. */
+        report.cycles = cycle.cycles;
+        report.envelope_min = report.envelope_max = cycle.mean[0];
+        for (unsigned int i = 0; i < FOLD_BINS; i++) {
+            report.envelope_min = MIN(report.envelope_min, cycle.min[i]);
+            report.envelope_max = MAX(report.envelope_max, cycle.max[i]);
+        }
+    } else {
+        /* Less than one cycle: just show what we have. */
+        period = count / 2;
+        if (narrow) {
+            graph_draw8(report.waveform, samples8, count);
+            report.flicker = mod_percent8(samples8, count);
+        } else {
+            graph_draw(report.waveform, samples, count);
+            report.flicker = mod_percent(samples, count);
+        }
+        report.cycles = 0;
+    }
+    report.window_ms = 2 * period / settings.rate * 1000;
 }
 
-/* Measure a light source and report on it.
+/* Measure a light source from scratch and queue a report on it.
  * Returns false on error. */
 static bool measure(void)
 {
     float frequency;
-    unsigned int cycle, mod;
+    unsigned int harmonics;
+    struct zoom peaks[ZOOM_MAX_PEAKS];
+    struct sample_stats stats;
+    bool narrow = (settings.bits == 8);
+    unsigned int count = settings.count;
+    unsigned int limit = freq_limit();
+    /* Zooming uses all the samples, so its buckets are narrower
+     * than the FFT's if there are more than the FFT could take. */
+    float zoom_scale = (float) count / fft_count();
 
-    /* Set the gain so we'll fill the ADC range. */
-    agc_run(samples);
+    /* Whatever we were following, start again. */
+    track.locked = false;
 
-    /* Collect uint16_t samples in [0, 0xfff]. */
-    sample(SAMPLE_COUNT, SAMPLE_RATE, samples);
+    /* Set the gain so we'll fill the ADC range. */
+    report.agc_peak = agc_run(samples);
+    report.agc_level = agc_level();
+    report.tracking = 0;
 
-    /* Put the AGC back in a known safe state. */
-    agc_reset();
+    if (!capture(count, &stats)) {
+        return false;
+    }
 
-    /* Find the spectrum and the peak frequency. */
-    if (!window(samples, f.real, f.imag, SAMPLE_COUNT)) {
+    /* Find the spectrum and the peak frequency.  The DMA sniffer
+     * has already added up the samples, but if there are more of
+     * them than the FFT can take the window has to find its own mean. */
+    if (count != fft_count()) {
+        if (narrow) {
+            window8(samples8, f.real, f.imag, fft_count());
+        } else if (!window(samples, f.real, f.imag, fft_count())) {
+            output_text("Sampling errors: too many in a row.\n");
+            return false;
+        }
+    } else if (narrow) {
+        window8_sum(samples8, stats.sum, f.real, f.imag, count);
+    } else if (!window_sum(samples, stats.sum, f.real, f.imag, count)) {
+        output_text("Sampling errors: too many in a row.\n");
         return false;
     }
-    fft(f.real, f.imag, SAMPLE_COUNT);
-    make_polar(f.real, f.imag, f.magnitude, f.phase, FREQ_COUNT);
-    frequency = to_frequency(peak(f.magnitude, FREQ_LIMIT));
+    /* We only look at buckets below the limit, so don't
+     * spend time calculating the rest. */
+    fft_pruned(f.real, f.imag, fft_count(), limit);
+    make_polar(f.real, f.imag, f.magnitude, f.phase, limit);
+    frequency = to_frequency(peak(f.magnitude, limit));
 
     /* Look at the spectrum. */
-    graph_logx(f.magnitude, FREQ_LIMIT);
-    printf("FFT: peak at %fHz\n", frequency);
-    printf("FFT: peak magnitude %f\n",
-        f.magnitude[to_bucket(frequency)]);
-
-    /* Look at a couple of cycles of the raw samples. */
-    cycle = SAMPLE_RATE / frequency;
-    if (cycle > SAMPLE_COUNT / 2) {
-        cycle = SAMPLE_COUNT / 2;
-    }
-    graph(samples + SAMPLE_COUNT / 2 - cycle, cycle * 2);
-    mod = mod_percent(samples + SAMPLE_COUNT / 2 - cycle, cycle * 2);
-    printf("Raw samples: %dms, %d%% flicker.\n",
-           (unsigned int)(2 * cycle / SAMPLE_RATE * 1000),
-           mod);
+    graph_draw_logx(report.spectrum, f.magnitude, limit);
+    report.frequency = frequency;
+    report.magnitude = f.magnitude[MIN(to_bucket(frequency), limit - 1)];
 
+    /* Look more closely at the peak, and its harmonics. */
+    for (harmonics = 0; harmonics < settings.zoom; harmonics++) {
+        float bucket = (harmonics + 1) * to_bucket_exact(frequency);
+        if (bucket >= limit) {
+            break;
+        }
+        peaks[harmonics].bucket = bucket * zoom_scale;
+    }
+    report.harmonics = harmonics;
+    if (harmonics > 0) {
+        if (narrow) {
+            zoom8(samples8, count, peaks, harmonics);
+        } else {
+            zoom(samples, count, peaks, harmonics);
+        }
+        for (unsigned int h = 0; h < harmonics; h++) {
+            report.harmonic[h].frequency =
+                to_frequency(peaks[h].bucket / zoom_scale);
+            report.harmonic[h].magnitude = peaks[h].magnitude;
+        }
+        frequency = report.harmonic[0].frequency;
+    }
+
+    /* The whole harmonic series, from the spectrum we already have. */
+    harmonic_series(f.magnitude, limit, to_bucket_exact(frequency), &series);
+    report.series_count = series.count;
+    for (unsigned int h = 0; h < series.count; h++) {
+        report.series[h].frequency = to_frequency(series.harmonic[h].bucket);
+        report.series[h].magnitude = series.harmonic[h].magnitude;
+    }
+
+    waveform(count, frequency);
+
+    /* If the console can't keep up, this one gets dropped;
+     * but it always goes in the log. */
+    output_report(&report);
+    history_add(&report, f.magnitude, limit);
+
+    /* Follow this light from now on, if it's one we can follow. */
+    if (report.cycles > 0 && !*agc_warning(report.agc_peak)) {
+        track.locked = true;
+        track.frequency = frequency;
+        track.level = (harmonics > 0) ?
+            report.harmonic[0].magnitude / count :
+            report.magnitude / fft_count();
+        track.agc_level = report.agc_level;
+        track.limit = limit;
+        track.next_log = make_timeout_time_ms(TRACK_LOG_MS);
+    }
     return true;
 }
 
+/* Measure the light we're tracking, and queue a report on it.
+ * Returns false if we've lost it, or couldn't get a clean capture, and
+ * need a full measurement. */
+static bool measure_tracked(void)
+{
+    struct zoom peaks[ZOOM_MAX_PEAKS];
+    struct sample_stats stats;
+    bool narrow = (settings.bits == 8);
+    unsigned int harmonics;
+    /* Just long enough to see the fundamental clearly. */
+    unsigned int count = ceilf(TRACK_CYCLES * settings.rate / track.frequency);
+    count = MIN(MAX(count, MIN_SAMPLE_COUNT), settings.count);
+    /* Buckets of a spectrum of this many samples, which is what zoom()
+     * works in, and how they compare with a full measurement's. */
+    float hz_per_zoom_bucket = settings.rate / count;
+    float full_scale = (float) settings.count / count;
+
+    /* Same gain as last time. */
+    agc_set_level(track.agc_level);
+    report.agc_level = track.agc_level;
+    report.tracking = count;
+
+    if (!capture(count, &stats)) {
+        /* Fall back to a full measurement, which either gets through
+         * or reports the errors, so the console hears about it. */
+        return false;
+    }
+
+    /* The fundamental and as many harmonics as we'd zoom in on, but
+     * only those below the limit, as a full measurement would. */
+    for (harmonics = 0; harmonics < MAX(settings.zoom, 1u); harmonics++) {
+        float hz = (harmonics + 1) * track.frequency;
+        if (harmonics > 0 && hz >= settings.limit) {
+            break;
+        }
+        peaks[harmonics].bucket = hz / hz_per_zoom_bucket;
+    }
+    float expected = peaks[0].bucket;
+    if (narrow) {
+        zoom8(samples8, count, peaks, harmonics);
+    } else {
+        zoom(samples, count, peaks, harmonics);
+    }
+
+    /* zoom() only looks half a bucket either side of where we said;
+     * if the best it found was at the edge, the light has moved. */
+    float level = peaks[0].magnitude / count;
+    if (fabsf(peaks[0].bucket - expected) >
+            ZOOM_SPACING * (ZOOM_POINTS - 1) / 2 ||
+        level > track.level * TRACK_LEVEL_RATIO ||
+        level < track.level / TRACK_LEVEL_RATIO) {
+        return false;
+    }
+
+    /* The spectrum graph stays as the last full measurement left it.
+     * There's no whole-band spectrum to find the harmonic series in,
+     * so leave that out rather than repeat an old one.  The numbers
+     * are on the same scale as a full measurement's. */
+    report.series_count = 0;
+    report.frequency = peaks[0].bucket * hz_per_zoom_bucket;
+    report.magnitude = peaks[0].magnitude * fft_count() / count;
+    report.harmonics = MIN(harmonics, settings.zoom);
+    for (unsigned int h = 0; h < report.harmonics; h++) {
+        report.harmonic[h].frequency = peaks[h].bucket * hz_per_zoom_bucket;
+        report.harmonic[h].magnitude = peaks[h].magnitude * full_scale;
+    }
+
+    /* There's no separate AGC pass to say how bright it is, so go by
+     * the brightest the cycles got. */
+    waveform(count, report.frequency);
+    report.agc_peak = report.envelope_max;
+    if (report.cycles == 0 || *agc_warning(report.agc_peak)) {
+        return false;
+    }
+
+    output_report(&report);
+    if (time_reached(track.next_log)) {
+        history_add(&report, f.magnitude, track.limit);
+        track.next_log = make_timeout_time_ms(TRACK_LOG_MS);
+    }
+
+    /* Follow it as it drifts. */
+    track.frequency = report.frequency;
+    track.level = level;
+    return true;
+}
+
+/* Report on a captured event, which is at the start of samples[].
+ * This is printed directly, so it waits for the output queue. */
+static void report_event(void)
+{
+    output_flush();
+    if (event.lost) {
+        if (event.reason) {
+            printf("Event: %s trigger at level %u (mean %u), ",
+                   event.reason, event.level, event.mean);
+        } else {
+            printf("Event: ");
+        }
+        printf("lost: %s\n", event.lost);
+        return;
+    }
+    printf("Event: %s trigger at level %u (mean %u), sample %u\n",
+           event.reason, event.level, event.mean, event.trigger);
+    graph(samples, event.length);
+    printf("Event: %u samples, %ums, %d%% flicker.\n",
+           event.length,
+           (unsigned int)(event.length / settings.rate * 1000),
+           mod_percent(samples, event.length));
+}
+
+/* Console commands. */
+
+/* Event capture owns the sampler, and its settings, from when it's
+ * armed until it's turned off.  Commands that would change them check
+ * this first, and refuse if it says so. */
+static bool sampler_busy(void)
+{
+    if (event_state != EVENT_OFF) {
+        command_error("event capture is using the sampler");
+        return true;
+    }
+    return false;
+}
+
+static void cmd_measure(unsigned int argc, char **argv)
+{
+    (void) argv;
+    if (argc != 1) {
+        command_error("usage: measure");
+        return;
+    }
+    if (sampler_busy()) {
+        return;
+    }
+    measure_requested = true;
+    command_ok("measure");
+}
+
+static void cmd_mode(unsigned int argc, char **argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "continuous")) {
+        settings.continuous = true;
+    } else if (argc == 2 && !strcmp(argv[1], "single")) {
+        settings.continuous = false;
+    } else {
+        command_error("usage: mode continuous|single");
+        return;
+    }
+    command_ok("mode %s", argv[1]);
+}
+
+static void cmd_track(unsigned int argc, char **argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "on")) {
+        settings.track = true;
+    } else if (argc == 2 && !strcmp(argv[1], "off")) {
+        settings.track = false;
+    } else {
+        command_error("usage: track on|off");
+        return;
+    }
+    command_ok("track %s", argv[1]);
+}
+
+static void cmd_rate(unsigned int argc, char **argv)
+{
+    unsigned int hz;
+    if (argc != 2 || !command_number(argv[1], &hz) ||
+        hz < MIN_SAMPLE_RATE || hz > MAX_SAMPLE_RATE) {
+        command_error("usage: rate %u-%u", MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+        return;
+    }
+    if (sampler_busy()) {
+        return;
+    }
+    /* Keep the frequency limit in the same proportion. */
+    settings.limit *= hz / settings.rate;
+    settings.rate = hz;
+    /* What we were tracking no longer matches the settings. */
+    track.locked = false;
+    command_ok("rate %u", hz);
+}
+
+static void cmd_count(unsigned int argc, char **argv)
+{
+    unsigned int count;
+    if (argc != 2 || !command_number(argv[1], &count) ||
+        count < MIN_SAMPLE_COUNT || count > max_count() ||
+        (count & (count - 1)) != 0) {
+        command_error("usage: count <power of 2, %u-%u>",
+                      MIN_SAMPLE_COUNT, max_count());
+        return;
+    }
+    if (sampler_busy()) {
+        return;
+    }
+    settings.count = count;
+    track.locked = false;
+    command_ok("count %u", count);
+}
+
+static void cmd_limit(unsigned int argc, char **argv)
+{
+    unsigned int hz;
+    if (argc != 2 || !command_number(argv[1], &hz) ||
+        hz == 0 || hz > settings.rate / 2) {
+        command_error("usage: limit <Hz, up to %u>",
+                      (unsigned int) settings.rate / 2);
+        return;
+    }
+    settings.limit = hz;
+    track.locked = false;
+    command_ok("limit %u", hz);
+}
+
+static void cmd_interval(unsigned int argc, char **argv)
+{
+    unsigned int ms;
+    if (argc != 2 || !command_number(argv[1], &ms)) {
+        command_error("usage: interval <ms>");
+        return;
+    }
+    settings.interval = ms;
+    command_ok("interval %u", ms);
+}
+
+/* event arm <pre> <post> [high N] [low N] [deviation N]
+ * event dump
+ * event off */
+static void cmd_event(unsigned int argc, char **argv)
+{
+    struct event_trigger trigger = { 0 };
+    unsigned int pre, post, value;
+    uint16_t peak;
+
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        event_disarm();
+        event_state = EVENT_OFF;
+        command_ok("event off");
+        return;
+    }
+
+    if (argc == 2 && !strcmp(argv[1], "dump")) {
+        if (event_state != EVENT_CAPTURED) {
+            command_error("no event captured");
+            return;
+        }
+        /* Raw samples in hex, 16 to a line, oldest first.
+         * Far too much to queue, so print it directly. */
+        output_flush();
+        printf("Event data: %u samples at %uHz, trigger at %u\n",
+               event.length, (unsigned int) settings.rate, event.trigger);
+        for (unsigned int i = 0; i < event.length; i++) {
+            printf("%03x%c", samples[i], (i % 16 == 15) ? '\n' : ' ');
+        }
+        if (event.length % 16) {
+            putchar('\n');
+        }
+        command_ok("event dump %u", event.length);
+        return;
+    }
+
+    if (argc < 4 || (argc % 2) != 0 || strcmp(argv[1], "arm") ||
+        !command_number(argv[2], &pre) || !command_number(argv[3], &post) ||
+        post == 0 || pre > SAMPLE_COUNT - EVENT_SLACK ||
+        post > SAMPLE_COUNT - EVENT_SLACK - pre) {
+        command_error("usage: event arm <pre> <post> [high N] [low N] "
+                      "[deviation N] | dump | off");
+        return;
+    }
+    for (unsigned int i = 4; i < argc; i += 2) {
+        if (!command_number(argv[i + 1], &value)) {
+            command_error("bad level '%s'", argv[i + 1]);
+            return;
+        } else if (!strcmp(argv[i], "high")) {
+            trigger.high = value;
+        } else if (!strcmp(argv[i], "low")) {
+            trigger.low = value;
+        } else if (!strcmp(argv[i], "deviation")) {
+            trigger.deviation = value;
+        } else {
+            command_error("unknown trigger '%s'", argv[i]);
+            return;
+        }
+    }
+    if (!trigger.high && !trigger.low && !trigger.deviation) {
+        command_error("no trigger condition");
+        return;
+    }
+
+    /* Set the gain for what we're looking at now, and leave it. */
+    event_disarm();
+    peak = agc_run(samples);
+    output_text("AGC: %d/127%s\n", agc_level(), agc_warning(peak));
+    event_arm(samples, SAMPLE_BITS, settings.rate, &trigger, pre, post);
+    event_state = EVENT_ARMED;
+    command_ok("event armed");
+}
+
+static void cmd_zoom(unsigned int argc, char **argv)
+{
+    unsigned int harmonics;
+    if (argc != 2 || !command_number(argv[1], &harmonics) ||
+        harmonics > ZOOM_MAX_PEAKS) {
+        command_error("usage: zoom 0-%u", ZOOM_MAX_PEAKS);
+        return;
+    }
+    settings.zoom = harmonics;
+    command_ok("zoom %u", harmonics);
+}
+
+static void cmd_errors(unsigned int argc, char **argv)
+{
+    unsigned int ppm;
+    if (argc != 2 || !command_number(argv[1], &ppm) || ppm > MAX_ERRORS) {
+        command_error("usage: errors <bad samples per million, 0-%u>",
+                      MAX_ERRORS);
+        return;
+    }
+    settings.errors = ppm;
+    command_ok("errors %u", ppm);
+}
+
+static void cmd_bits(unsigned int argc, char **argv)
+{
+    unsigned int bits;
+    if (argc != 2 || !command_number(argv[1], &bits) ||
+        (bits != 8 && bits != 12)) {
+        command_error("usage: bits 8|12");
+        return;
+    }
+    if (sampler_busy()) {
+        return;
+    }
+    settings.bits = bits;
+    /* 12-bit samples take twice the room. */
+    settings.count = MIN(settings.count, max_count());
+    track.locked = false;
+    command_ok("bits %u count %u", bits, settings.count);
+}
+
+/* One line of 'history dump'. */
+static void print_record(const struct history_record *r)
+{
+    printf("%lu,%u,%lu,%.3f,%u,%u,",
+           (unsigned long) r->sequence, r->boot, (unsigned long) r->seconds,
+           r->frequency, r->flicker, r->agc_level);
+    for (unsigned int b = 0; b < HISTORY_BANDS; b++) {
+        printf("%02x", r->spectrum[b]);
+    }
+    putchar('\n');
+}
+
+/* history
+ * history dump [count]
+ * history flush */
+static void cmd_history(unsigned int argc, char **argv)
+{
+    unsigned int count = history_count();
+
+    /* Dumping takes seconds, and writing to flash stalls us, either
+     * of which would lose track of the samples going by. */
+    if (argc > 1 && event_state == EVENT_ARMED) {
+        command_error("event capture can't wait for that");
+        return;
+    }
+    if (argc == 1) {
+        command_ok("history %u of %u records, %u failures",
+                   history_count(), history_capacity(), history_failures());
+    } else if (argc == 2 && !strcmp(argv[1], "flush")) {
+        history_flush();
+        command_ok("history flush");
+    } else if ((argc == 2 || argc == 3) && !strcmp(argv[1], "dump") &&
+               (argc == 2 || command_number(argv[2], &count))) {
+        /* Far too much to queue, so print it directly. */
+        output_flush();
+        printf("History: sequence,boot,seconds,frequency,flicker,agc,"
+               "spectrum\n");
+        history_each(count, print_record);
+        command_ok("history dump %u", MIN(count, history_count()));
+    } else {
+        command_error("usage: history [dump [count] | flush]");
+    }
+}
+
+static void cmd_status(unsigned int argc, char **argv)
+{
+    (void) argv;
+    if (argc != 1) {
+        command_error("usage: status");
+        return;
+    }
+    command_ok("mode %s rate %u count %u limit %u interval %u zoom %u "
+               "bits %u errors %u track %s",
+               settings.continuous ? "continuous" : "single",
+               (unsigned int) settings.rate, settings.count,
+               (unsigned int) settings.limit, settings.interval,
+               settings.zoom, settings.bits, settings.errors,
+               settings.track ? "on" : "off");
+}
+
+static const struct command commands[] = {
+    { "measure", "", cmd_measure },
+    { "mode", "continuous|single", cmd_mode },
+    { "track", "on|off", cmd_track },
+    { "rate", "<samples per second>", cmd_rate },
+    { "count", "<samples per measurement>", cmd_count },
+    { "limit", "<highest frequency of interest, Hz>", cmd_limit },
+    { "interval", "<ms between measurements>", cmd_interval },
+    { "zoom", "<harmonics to zoom in on, 0 for none>", cmd_zoom },
+    { "bits", "8|12", cmd_bits },
+    { "errors", "<bad samples per million to repair>", cmd_errors },
+    { "event", "arm <pre> <post> [high N] [low N] [deviation N] | dump | off",
+      cmd_event },
+    { "history", "[dump [count] | flush]", cmd_history },
+    { "status", "", cmd_status },
+    { NULL, NULL, NULL },
+};
+
 int main(void)
 {
+    absolute_time_t next;
+
     /* Debugging metadata that gets baked into the binary. */
     bi_decl(bi_program_name("flicker"));
     bi_decl(bi_program_version_string("1.0"));
@@ -170,11 +844,44 @@ int main(void)
     sample_init(PT_PIN);
     agc_init(AD5220_DIR_PIN, AD5220_CLOCK_PIN);
 
+    /* Pick up the measurement log where we left off. */
+    history_init();
+
+    /* Reports go on the OLED too, if there is one. */
+    display_init(ssd1306(OLED_SDA_PIN, OLED_SCL_PIN));
+
+    /* Core1 does all the talking from now on. */
+    output_init();
+
     gpio_put(LED_PIN, 0);
 
+    next = make_timeout_time_ms(settings.interval);
     while (1) {
-        /* TODO: wait for a button press? */
-        sleep_ms(2000);
-        measure();
+        /* Commands may ask for a measurement right away. */
+        command_poll(commands);
+
+        if (event_state == EVENT_ARMED) {
+            if (event_poll(&event)) {
+                agc_reset();
+                /* A lost event leaves nothing to dump. */
+                event_state = event.lost ? EVENT_OFF : EVENT_CAPTURED;
+                report_event();
+            }
+            continue;
+        }
+        if (event_state == EVENT_CAPTURED) {
+            continue;
+        }
+
+        if (measure_requested ||
+            (settings.continuous && time_reached(next))) {
+            measure_requested = false;
+            /* Tracking falls back to a full measurement if it's
+             * lost the light, or hasn't found one yet. */
+            if (!settings.track || !track.locked || !measure_tracked()) {
+                measure();
+            }
+            next = make_timeout_time_ms(settings.interval);
+        }
     }
 }
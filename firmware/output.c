@@ -0,0 +1,202 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+
+#include "agc.h"
+#include "assertions.h"
+#include "display.h"
+#include "graph.h"
+#include "output.h"
+
+/* Formatting the results and pushing them down the USB console takes
+ * far longer than measuring, and blocks whenever the host is slow to
+ * read.  So core0 just fills in a report and queues it, and core1
+ * turns it into text and puts it on the display, if there is one.
+ * Measurements only wait for the queue when it's full of command
+ * replies; reports that don't fit are dropped. */
+
+/* Queue length.  Reports are a few hundred bytes each. */
+#define QUEUE_LENGTH 4u
+
+/* Longest line of text we can queue. */
+#define TEXT_LENGTH 128u
+
+struct entry {
+    bool is_report;
+    union {
+        struct report report;
+        char text[TEXT_LENGTH];
+    };
+};
+
+/* Single-producer, single-consumer ring.  Core0 fills entries and
+ * moves 'head' on; core1 prints them and moves 'tail' on.  Each index
+ * is only ever written by one core, and they count up forever, so
+ * head - tail is always the number of entries in the queue. */
+static struct entry queue[QUEUE_LENGTH];
+static volatile uint32_t head, tail;
+
+/* Reports we've had to drop since the last one we queued.
+ * Only core0 touches this. */
+static unsigned int dropped;
+
+/* Print one measurement report.  The layout is the same one the
+ * meter has always printed; host tools depend on it. */
+static void print_report(const struct report *r)
+{
+    if (r->dropped) {
+        printf("(%u reports dropped: console too slow)\n", r->dropped);
+    }
+    printf("AGC: %d/127%s\n", r->agc_level, agc_warning(r->agc_peak));
+    if (r->errors) {
+        printf("Repaired %u bad samples.\n", r->errors);
+    }
+    if (r->tracking) {
+        printf("Tracking: %u samples.\n", r->tracking);
+    }
+
+    graph_print(r->spectrum);
+    printf("FFT: peak at %fHz\n", r->frequency);
+    printf("FFT: peak magnitude %f\n", r->magnitude);
+
+    if (r->harmonics > 0) {
+        printf("Zoom: peak at %fHz, magnitude %f\n",
+               r->harmonic[0].frequency, r->harmonic[0].magnitude);
+        for (unsigned int h = 1; h < r->harmonics; h++) {
+            printf("Zoom: harmonic %u at %fHz, %.1fdB\n", h + 1,
+                   r->harmonic[h].frequency,
+                   20 * log10f(r->harmonic[h].magnitude /
+                               r->harmonic[0].magnitude));
+        }
+    }
+
+    if (r->series_count > 1 && r->series[0].magnitude > 0) {
+        /* Total harmonic distortion, then each harmonic's level
+         * relative to the fundamental, to keep it to one line. */
+        float fundamental = r->series[0].magnitude, rest = 0;
+        for (unsigned int h = 1; h < r->series_count; h++) {
+            rest += r->series[h].magnitude * r->series[h].magnitude;
+        }
+        printf("Harmonics: THD %.1f%%, dB", 100 * sqrtf(rest) / fundamental);
+        for (unsigned int h = 1; h < r->series_count; h++) {
+            printf(" %.0f", 20 * log10f(r->series[h].magnitude / fundamental));
+        }
+        putchar('\n');
+    }
+
+    graph_print(r->waveform);
+    if (r->cycles > 0) {
+        printf("Averaged %u cycles; envelope %u to %u, %d%% flicker.\n",
+               r->cycles, r->envelope_min, r->envelope_max,
+               (int) roundf(100.0 * (r->envelope_max - r->envelope_min) /
+                            (r->envelope_max + r->envelope_min)));
+    }
+    printf("Raw samples: %dms, %d%% flicker.\n", r->window_ms, r->flicker);
+}
+
+/* Core1: print whatever turns up in the queue, forever. */
+static void output_main(void)
+{
+    /* We run from flash, so let core0 pause us while it writes
+     * the history log. */
+    flash_safe_execute_core_init();
+
+    while (true) {
+        while (tail == head) {
+            __wfe();
+        }
+        /* Don't read the entry until we've seen head move past it. */
+        __mem_fence_acquire();
+
+        const struct entry *e = &queue[tail % QUEUE_LENGTH];
+        if (e->is_report) {
+            print_report(&e->report);
+            /* The display driver sends it in the background. */
+            display_show(&e->report);
+        } else {
+            fputs(e->text, stdout);
+        }
+
+        /* Finish with the entry before handing it back. */
+        __mem_fence_release();
+        tail = tail + 1;
+        __sev();
+    }
+}
+
+/* Start the output core. */
+void output_init(void)
+{
+    multicore_launch_core1(output_main);
+}
+
+/* Find a free entry, waiting for one if @wait.
+ * Returns NULL if the queue is full and we're not waiting. */
+static struct entry *claim(bool wait)
+{
+    while (head - tail == QUEUE_LENGTH) {
+        if (!wait) {
+            return NULL;
+        }
+        __wfe();
+    }
+    /* Don't write the entry until core1 has finished with it. */
+    __mem_fence_acquire();
+    return &queue[head % QUEUE_LENGTH];
+}
+
+/* Hand a filled-in entry over to core1. */
+static void publish(void)
+{
+    __mem_fence_release();
+    head = head + 1;
+    __sev();
+}
+
+/* Queue a measurement report, or drop it if the queue is full. */
+bool output_report(const struct report *report)
+{
+    struct entry *e = claim(false);
+    if (!e) {
+        dropped++;
+        return false;
+    }
+    e->is_report = true;
+    e->report = *report;
+    e->report.dropped = dropped;
+    dropped = 0;
+    publish();
+    return true;
+}
+
+/* Queue a line of text, waiting for room. */
+void output_vtext(const char *format, va_list args)
+{
+    struct entry *e = claim(true);
+    e->is_report = false;
+    vsnprintf(e->text, TEXT_LENGTH, format, args);
+    publish();
+}
+
+void output_text(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    output_vtext(format, args);
+    va_end(args);
+}
+
+/* Wait for everything queued so far to be written out. */
+void output_flush(void)
+{
+    while (tail != head) {
+        __wfe();
+    }
+    __mem_fence_acquire();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dsp.h"
+#include "graph.h"
+
+/* Everything we say about one measurement. */
+struct report {
+    unsigned int dropped;           /* Reports dropped before this one. */
+    unsigned int agc_level;
+    unsigned int errors;            /* Bad samples filled in. */
+    unsigned int tracking;          /* Samples if tracking, else 0. */
+    uint16_t agc_peak;
+    uint8_t spectrum[GRAPH_BYTES];
+    float frequency;                /* FFT peak, Hz. */
+    float magnitude;
+    unsigned int harmonics;         /* Zoomed-in peaks, 0 if none. */
+    struct {
+        float frequency;            /* Hz. */
+        float magnitude;
+    } harmonic[ZOOM_MAX_PEAKS];
+    unsigned int series_count;      /* Harmonic series, from the FFT. */
+    struct {
+        float frequency;            /* Hz. */
+        float magnitude;
+    } series[SERIES_MAX];
+    uint8_t waveform[GRAPH_BYTES];
+    unsigned int cycles;            /* Cycles averaged, 0 if none. */
+    unsigned int envelope_min, envelope_max;
+    unsigned int window_ms;
+    int flicker;
+};
+
+/* Start the output core.  Until this is called, nothing comes out. */
+extern void output_init(void);
+
+/* Queue a measurement report for output.  If the console is so slow
+ * that the queue is full, the report is dropped and counted instead,
+ * and the next report that gets through says how many were lost.
+ * Returns false if it was dropped. */
+extern bool output_report(const struct report *report);
+
+/* Queue a line of text for output.  Never dropped: waits for room. */
+extern void output_text(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+extern void output_vtext(const char *format, va_list args);
+
+/* Wait for everything queued so far to be written out, so the caller
+ * can print directly without getting mixed up with it. */
+extern void output_flush(void);
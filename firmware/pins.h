@@ -20,3 +20,9 @@ bi_decl(bi_1pin_with_name(SMPS_PIN, "Pico SMPS control"));
 /* Pico's on-board LED. */
 #define LED_PIN 25
 bi_decl(bi_1pin_with_name(LED_PIN, "Pico LED"));
+
+/* SSD1306 OLED display, on I2C0. */
+#define OLED_SDA_PIN 4 /* Pico 6 */
+bi_decl(bi_1pin_with_name(OLED_SDA_PIN, "OLED I2C SDA"));
+#define OLED_SCL_PIN 5 /* Pico 7 */
+bi_decl(bi_1pin_with_name(OLED_SCL_PIN, "OLED I2C SCL"));
@@ -1,6 +1,8 @@
 #include "hardware/adc.h"
 #include "hardware/dma.h"
 
+#include "pico/stdlib.h"
+
 #include "assertions.h"
 #include "sample.h"
 
@@ -8,6 +10,75 @@
 static unsigned int channel;
 static dma_channel_config config;
 
+/* The DMA sniffer adds up samples as they go past.  16- and 8-bit
+ * transfers may be replicated across the 32-bit bus, so it can add
+ * each one multiplied by 0x10001 or 0x01010101; multiplying the total
+ * by the inverse of that (mod 2^32) gets the real sum back, as long
+ * as it fits in 32 bits. */
+static uint32_t unsniff16;
+static uint32_t unsniff8;
+
+/* For continuous sampling, a second channel restarts the first
+ * every time it gets to the end of the ring buffer. */
+static unsigned int restart_channel;
+static uint32_t ring_length;
+
+/* Where the ring is, and how far round it we've seen the DMA get. */
+static const uint16_t *ring_base;
+static unsigned int ring_position;
+static uint32_t ring_count;
+
+/* The longest sample_ring_count() can safely go between calls, and
+ * when it was last called.  The DMA's write address only says where
+ * it is in the ring, not how many laps it's done, so the clock is
+ * the only way to tell if we missed one. */
+static uint64_t ring_lap_us;
+static uint64_t ring_checked_us;
+static bool ring_lapped;
+
+/* Set the sample width: 8 bits if @narrow, otherwise 16. */
+static void set_width(bool narrow)
+{
+    /* In 8-bit mode the FIFO shifts each sample down so the DMA can
+     * take just the bottom byte.  The error flag would be in the byte
+     * it leaves behind, so don't bother with it. */
+    adc_fifo_setup(
+        true,       /* FIFO enabled. */
+        true,       /* DMA requests enabled. */
+        1,          /* DMA when FIFO level >= 1. */
+        !narrow,    /* Use bit 15 as error flag. */
+        narrow);    /* Keep only the top 8 data bits? */
+    channel_config_set_transfer_data_size(&config,
+        narrow ? DMA_SIZE_8 : DMA_SIZE_16);
+}
+
+/* Find what the sniffer multiplies each transfer of @size by,
+ * by sniffing a memory-to-memory copy of a 1 on DMA channel @ch,
+ * and return its inverse. */
+static uint32_t sniff_inverse(unsigned int ch, enum dma_channel_transfer_size size)
+{
+    static uint32_t one = 1, scratch;
+    dma_channel_config copy = dma_channel_get_default_config(ch);
+
+    channel_config_set_transfer_data_size(&copy, size);
+    channel_config_set_sniff_enable(&copy, true);
+    dma_sniffer_enable(ch, DMA_SNIFF_CTRL_CALC_VALUE_SUM, false);
+    dma_sniffer_set_data_accumulator(0);
+    dma_channel_configure(ch, &copy, &scratch, &one, 1, true);
+    dma_channel_wait_for_finish_blocking(ch);
+
+    /* Odd numbers have inverses mod 2^32.  Each Newton step doubles
+     * the number of good bits, and x = factor is good for 3. */
+    uint32_t factor = dma_sniffer_get_data_accumulator();
+    ASSERT(factor & 1);
+    uint32_t x = factor;
+    for (unsigned int i = 0; i < 4; i++) {
+        x *= 2 - factor * x;
+    }
+    dma_sniffer_disable();
+    return x;
+}
+
 /* Set up the ADC hardware once at boot time. */
 void sample_init(unsigned int pin)
 {
@@ -22,12 +93,6 @@ void sample_init(unsigned int pin)
     adc_init();
     adc_run(false);
     adc_select_input(input);
-    adc_fifo_setup(
-        true,   /* FIFO enabled. */
-        true,   /* DMA requests enabled. */
-        1,      /* DMA when FIFO level >= 1. */
-        true,   /* Use bit 15 as error flag. */
-        false); /* Use all 12 data bits. */
 
     /* DMA engine config.
      * This just populates config, doesn't prod hardware yet. */
@@ -35,13 +100,22 @@ void sample_init(unsigned int pin)
     config = dma_channel_get_default_config(channel);
     channel_config_set_read_increment(&config, false);
     channel_config_set_write_increment(&config, true);
-    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
     channel_config_set_dreq(&config, DREQ_ADC);
+    channel_config_set_sniff_enable(&config, true);
+
+    /* FIFO and DMA sizes, 16-bit to start with. */
+    set_width(false);
+
+    restart_channel = dma_claim_unused_channel(true);
+
+    /* The restart channel isn't busy yet, so it can help
+     * find out how the sniffer adds things up. */
+    unsniff16 = sniff_inverse(restart_channel, DMA_SIZE_16);
+    unsniff8 = sniff_inverse(restart_channel, DMA_SIZE_8);
 }
 
-/* Take @count ADC samples at @hz Hz.
- * Blocks until sampling is complete. */
-void sample(unsigned int count, float hz, uint16_t *dest)
+/* Set the ADC's sample rate. */
+static void set_rate(float hz)
 {
     /* The ADC samples every (1 + clkdiv) 48MHz cycles, on average.
      * Minimum period is 96 cycles = 500kHz. */
@@ -54,10 +128,28 @@ void sample(unsigned int count, float hz, uint16_t *dest)
         divider = 0;
     }
     adc_set_clkdiv(divider);
+}
+
+/* Take @count samples at @hz Hz into @dest, which holds bytes if
+ * @narrow is set.  Blocks until sampling is complete. */
+static struct sample_stats capture(unsigned int count,
+                                   float hz,
+                                   bool narrow,
+                                   void *dest)
+{
+    struct sample_stats stats;
+
+    set_rate(hz);
+    set_width(narrow);
 
     /* Clear old state, just in case. */
     adc_run(false);
     adc_fifo_drain();
+    hw_set_bits(&adc_hw->cs, ADC_CS_ERR_STICKY_BITS);
+
+    /* Have the sniffer add the samples up on the way. */
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_SUM, false);
+    dma_sniffer_set_data_accumulator(0);
 
     /* Start the DMA engine. */
     dma_channel_configure(
@@ -76,4 +168,125 @@ void sample(unsigned int count, float hz, uint16_t *dest)
 
     /* Stop the ADC. */
     adc_run(false);
+
+    stats.sum = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    if (narrow) {
+        stats.sum = (stats.sum * unsniff8) << SAMPLE_NARROW_SHIFT;
+    } else {
+        stats.sum *= unsniff16;
+    }
+    stats.errors = adc_hw->cs & ADC_CS_ERR_STICKY_BITS;
+    return stats;
+}
+
+/* Take @count ADC samples at @hz Hz.
+ * Blocks until sampling is complete. */
+struct sample_stats sample(unsigned int count, float hz, uint16_t *dest)
+{
+    return capture(count, hz, false, dest);
+}
+
+/* Take @count 8-bit ADC samples at @hz Hz.
+ * Blocks until sampling is complete. */
+struct sample_stats sample8(unsigned int count, float hz, uint8_t *dest)
+{
+    return capture(count, hz, true, dest);
+}
+
+/* Sample continuously at @hz Hz into @ring, which holds 2^@bits
+ * uint16_ts and must be aligned to its own size.  Returns at once;
+ * sampling carries on until sample_ring_stop(). */
+void sample_ring_start(float hz, uint16_t *ring, unsigned int bits)
+{
+    dma_channel_config ring_config;
+    dma_channel_config restart_config;
+
+    /* The DMA engine wraps writes within a naturally-aligned
+     * ring of up to 32kB. */
+    ASSERT(bits >= 1 && bits <= 14);
+    ASSERT(((uintptr_t) ring & ((2u << bits) - 1)) == 0);
+    ring_length = 1u << bits;
+    ring_base = ring;
+    ring_position = 0;
+    ring_count = 0;
+    /* Keep an eighth of a lap in hand for the time it takes to read
+     * the clock and the DMA's address. */
+    ring_lap_us = (uint64_t)(ring_length * 7 / 8 * 1e6f / hz);
+    ring_lapped = false;
+
+    set_rate(hz);
+    set_width(false);
+    adc_run(false);
+    adc_fifo_drain();
+
+    /* A sum over a ring that's overwriting itself isn't much use. */
+    ring_config = config;
+    channel_config_set_sniff_enable(&ring_config, false);
+
+    /* The sampling channel goes round the ring once, then hands
+     * over to the restart channel... */
+    channel_config_set_ring(&ring_config, true, bits + 1);
+    channel_config_set_chain_to(&ring_config, restart_channel);
+    dma_channel_configure(
+        channel,        /* On our reserved channel. */
+        &ring_config,   /* Wrapping round the ring. */
+        ring,           /* To the caller's buffer. */
+        &adc_hw->fifo,  /* From the ADC engine's FIFO. */
+        ring_length,    /* One lap of the ring at a time. */
+        false);         /* Not yet. */
+
+    /* ...which writes the lap length back into its transfer count,
+     * setting it going again.  The write address has already
+     * wrapped back to the start of the ring.  The ADC FIFO covers
+     * the few cycles that takes, so no samples are lost. */
+    restart_config = dma_channel_get_default_config(restart_channel);
+    channel_config_set_read_increment(&restart_config, false);
+    channel_config_set_write_increment(&restart_config, false);
+    channel_config_set_transfer_data_size(&restart_config, DMA_SIZE_32);
+    dma_channel_configure(
+        restart_channel,
+        &restart_config,
+        &dma_hw->ch[channel].al1_transfer_count_trig,
+        &ring_length,
+        1,
+        false);
+
+    dma_channel_start(channel);
+    adc_run(true);
+    ring_checked_us = time_us_64();
+}
+
+/* How many samples have arrived since sample_ring_start(), mod 2^32.
+ * Must be called at least once per lap of the ring to keep count. */
+uint32_t sample_ring_count(void)
+{
+    uint64_t now = time_us_64();
+    if (now - ring_checked_us > ring_lap_us) {
+        ring_lapped = true;
+    }
+    ring_checked_us = now;
+
+    uint32_t offset = dma_hw->ch[channel].write_addr - (uintptr_t) ring_base;
+    unsigned int position = (offset / sizeof *ring_base) & (ring_length - 1);
+
+    ring_count += (position - ring_position) & (ring_length - 1);
+    ring_position = position;
+    return ring_count;
+}
+
+/* Whether sample_ring_count() has been called too late to count. */
+bool sample_ring_lapped(void)
+{
+    return ring_lapped;
+}
+
+/* Stop continuous sampling. */
+void sample_ring_stop(void)
+{
+    adc_run(false);
+    /* Stop the restarter first so it can't set sampling going again. */
+    dma_channel_abort(restart_channel);
+    dma_channel_abort(channel);
+    adc_fifo_drain();
 }
@@ -1,13 +1,67 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Set up the ADC hardware once at boot time. */
 extern void sample_init(unsigned int pin);
 
+/* What the DMA sniffer worked out as a capture went past,
+ * so nobody needs to read through it again to find it. */
+struct sample_stats {
+    /* Total of the samples, on the same 12-bit scale as sample_at(),
+     * including any error flags.  Exact for up to 2^20 samples
+     * without errors. */
+    uint32_t sum;
+    /* Whether the ADC flagged any conversion errors, including in
+     * 8-bit samples, which don't have room to say which ones. */
+    bool errors;
+};
+
 /* Take @count ADC samples at @hz Hz.
  * Blocks until sampling is complete. */
-extern void sample(unsigned int count, float hz, uint16_t *dest);
+extern struct sample_stats sample(unsigned int count,
+                                  float hz,
+                                  uint16_t *dest);
+
+/* Take @count 8-bit ADC samples at @hz Hz: the top 8 of the ADC's 12
+ * bits, half the size and with no error flag.
+ * Blocks until sampling is complete. */
+extern struct sample_stats sample8(unsigned int count,
+                                   float hz,
+                                   uint8_t *dest);
+
+/* Sample continuously at @hz Hz into @ring, which holds 2^@bits
+ * uint16_ts and must be aligned to its own size.  Returns at once;
+ * sampling carries on until sample_ring_stop(). */
+extern void sample_ring_start(float hz, uint16_t *ring, unsigned int bits);
+
+/* How many samples have arrived since sample_ring_start(), mod 2^32.
+ * Must be called at least once per lap of the ring to keep count. */
+extern uint32_t sample_ring_count(void);
+
+/* Whether sample_ring_count() has ever gone so long between calls
+ * since sample_ring_start() that the ring may have lapped it, and its
+ * count can't be trusted. */
+extern bool sample_ring_lapped(void);
+
+/* Stop continuous sampling. */
+extern void sample_ring_stop(void);
 
 /* Samples with this bit set were ADC errors. */
 #define SAMPLE_ERROR ((uint16_t) 0x8000)
+
+/* 8-bit samples are shifted up by this much to put them on the same
+ * scale as 12-bit ones. */
+#define SAMPLE_NARROW_SHIFT 4
+
+/* Sample @i of a buffer of either 16-bit samples, or 8-bit ones
+ * if @narrow, on the 12-bit scale. */
+static inline unsigned int sample_at(const void *samples,
+                                     bool narrow,
+                                     unsigned int i)
+{
+    return narrow ?
+        (unsigned int)((const uint8_t *) samples)[i] << SAMPLE_NARROW_SHIFT :
+        ((const uint16_t *) samples)[i];
+}
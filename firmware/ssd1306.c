@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/i2c.h"
+
+#include "pico/stdlib.h"
+
+#include "display.h"
+
+/* The usual 128x64 SSD1306 OLED module, on I2C.
+ *
+ * Each update is a string of I2C transactions: for every changed
+ * page, one setting the column and page range and one with the new
+ * bytes.  They all go in one buffer of words for the I2C data/command
+ * register, with the STOP bit set at the end of each transaction, and
+ * one DMA transfer feeds them to the I2C FIFO while we get on with
+ * something else.  A full screen takes about 25ms at 400kHz. */
+
+#define I2C i2c0
+#define I2C_HZ 400000u
+#define ADDRESS 0x3c
+
+/* First byte of each transaction: commands or display data follow. */
+#define CONTROL_COMMANDS 0x00
+#define CONTROL_DATA 0x40
+
+/* Commands. */
+#define SET_COLUMN_RANGE 0x21
+#define SET_PAGE_RANGE 0x22
+
+/* Setup, from the datasheet's example: the charge pump on, horizontal
+ * addressing (so a range of columns on one page is one run of bytes),
+ * and the panel the right way up. */
+static const uint8_t setup[] = {
+    CONTROL_COMMANDS,
+    0xae,               /* Display off. */
+    0xd5, 0x80,         /* Clock divider. */
+    0xa8, 0x3f,         /* 64 rows. */
+    0xd3, 0x00,         /* No vertical offset. */
+    0x40,               /* Start at row 0. */
+    0x8d, 0x14,         /* Charge pump on. */
+    0x20, 0x00,         /* Horizontal addressing. */
+    0xa1,               /* Column 127 is on the right. */
+    0xc8,               /* Scan rows bottom to top. */
+    0xda, 0x12,         /* Alternate row wiring. */
+    0x81, 0xcf,         /* Contrast. */
+    0xd9, 0xf1,         /* Precharge. */
+    0xdb, 0x40,         /* Deselect level. */
+    0xa4,               /* Show the RAM. */
+    0xa6,               /* Not inverted. */
+    0xaf,               /* Display on. */
+};
+
+/* Give up on a panel that's stopped answering. */
+#define SETUP_TIMEOUT_US 10000u
+#define UPDATE_TIMEOUT_US 100000u
+
+/* Words per page: 7 for the ranges, then the data control byte
+ * and up to a whole page of data. */
+#define PAGE_WORDS (7u + 1u + DISPLAY_WIDTH)
+
+static unsigned int sda, scl;
+static int channel = -1;
+
+/* The transactions being sent. */
+static uint16_t words[DISPLAY_PAGES * PAGE_WORDS];
+
+/* Set up the I2C bus and the panel. */
+static bool ssd1306_init(void)
+{
+    dma_channel_config config;
+
+    i2c_init(I2C, I2C_HZ);
+    gpio_set_function(sda, GPIO_FUNC_I2C);
+    gpio_set_function(scl, GPIO_FUNC_I2C);
+    gpio_pull_up(sda);
+    gpio_pull_up(scl);
+
+    /* Nobody there, or nobody answering. */
+    if (i2c_write_timeout_us(I2C, ADDRESS, setup, sizeof setup, false,
+                             SETUP_TIMEOUT_US) != sizeof setup) {
+        return false;
+    }
+
+    channel = dma_claim_unused_channel(true);
+    config = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, i2c_get_dreq(I2C, true));
+    dma_channel_configure(channel, &config,
+                          &i2c_get_hw(I2C)->data_cmd, words, 0, false);
+    return true;
+}
+
+/* Wait for the last update to go.  If the panel has stopped
+ * answering, the I2C block aborts: it either stops taking data, or
+ * throws away whatever the DMA gives it.  Either way, give up on it
+ * and clear the abort.  Returns false if the update didn't all get
+ * there. */
+static bool wait(void)
+{
+    absolute_time_t deadline = make_timeout_time_us(UPDATE_TIMEOUT_US);
+    bool ok = true;
+
+    while (dma_channel_is_busy(channel)) {
+        if (time_reached(deadline)) {
+            dma_channel_abort(channel);
+            ok = false;
+            break;
+        }
+        tight_loop_contents();
+    }
+    if (i2c_get_hw(I2C)->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        ok = false;
+    }
+    if (!ok) {
+        (void) i2c_get_hw(I2C)->clr_tx_abrt;
+    }
+    return ok;
+}
+
+/* Start sending the changed pages. */
+static bool ssd1306_update(const struct display_frame *frame,
+                           const struct display_span spans[DISPLAY_PAGES])
+{
+    unsigned int n = 0;
+    bool ok = wait();
+
+    for (unsigned int p = 0; p < DISPLAY_PAGES; p++) {
+        unsigned int first = spans[p].first, last = spans[p].last;
+        if (first > last) {
+            continue;
+        }
+
+        words[n++] = CONTROL_COMMANDS;
+        words[n++] = SET_COLUMN_RANGE;
+        words[n++] = first;
+        words[n++] = last;
+        words[n++] = SET_PAGE_RANGE;
+        words[n++] = p;
+        words[n++] = p | I2C_IC_DATA_CMD_STOP_BITS;
+
+        words[n++] = CONTROL_DATA;
+        for (unsigned int x = first; x <= last; x++) {
+            words[n++] = frame->page[p][x];
+        }
+        words[n - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+    }
+
+    if (n > 0) {
+        dma_channel_transfer_from_buffer_now(channel, words, n);
+    }
+    return ok;
+}
+
+static const struct display_driver driver = {
+    .init = ssd1306_init,
+    .update = ssd1306_update,
+};
+
+/* Driver for an SSD1306 with its data and clock on these pins. */
+const struct display_driver *ssd1306(unsigned int sda_pin,
+                                     unsigned int scl_pin)
+{
+    sda = sda_pin;
+    scl = scl_pin;
+    return &driver;
+}
@@ -0,0 +1,243 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+
+#include "pico/float.h"
+#include "pico/stdlib.h"
+#include "pico/binary_info.h"
+
+#include "../assertions.h"
+#include "../dsp.h"
+#include "../fft.h"
+#include "../graph.h"
+#include "../pins.h"
+#include "../sample.h"
+
+/* Time the DSP kernels on the real hardware, where floating point is
+ * done in software and code runs from flash through a 16kB cache.
+ *
+ * Every result is one line:
+ *   BENCH,<placement>,<kernel>,<length>,<cache>,<calls>,<cycles>,<us>
+ * where placement is "xip" (code runs from flash) or "sram" (the
+ * bench-ram build, copied to RAM at boot), cache is "warm" (the kernel
+ * has just run) or "cold" (the XIP cache was flushed first), and
+ * cycles and us are per call, averaged over the calls. */
+
+#ifndef BENCH_PLACEMENT
+#define BENCH_PLACEMENT "xip"
+#endif
+
+/* Biggest input, as in the real firmware. */
+#define MAX_LENGTH (16u * 1024u)
+
+/* Keep timing a kernel until it's had this long, or this many calls. */
+#define MIN_TOTAL_US 20000u
+#define MAX_CALLS 100u
+
+/* SysTick is only 24 bits, so for anything longer than this
+ * we work the cycles out from the microsecond timer instead. */
+#define SYSTICK_MAX_US 100000u
+
+/* Assertion failures stop the world and keep logging. */
+void assertion_failure(const char *pred, const char *file, int line)
+{
+    while (true) {
+        printf("ASSERTION FAILED at %s line %d: %s\n", file, line, pred);
+        sleep_ms(1000);
+    }
+}
+
+/* Kernel inputs and outputs. */
+static uint16_t samples[MAX_LENGTH];
+static float real[MAX_LENGTH];
+static float imag[MAX_LENGTH];
+static uint8_t frame[GRAPH_BYTES];
+
+/* Something for the kernels to chew on: a 100Hz-ish tone at 250kHz,
+ * with a harmonic and some noise, in ADC units. */
+static void make_samples(unsigned int length)
+{
+    srand(37);
+    for (unsigned int i = 0; i < length; i++) {
+        float t = i / 2500.0f;
+        samples[i] = 2000 + 1000 * sinf(M_TWOPI * t)
+                   + 300 * sinf(2 * M_TWOPI * t) + (rand() % 41) - 20;
+    }
+}
+
+/* Each kernel has some untimed setup, so every call gets the same
+ * input even if the last call overwrote it. */
+struct kernel {
+    const char *name;
+    void (*setup)(unsigned int length);
+    void (*run)(unsigned int length);
+};
+
+static void setup_window(unsigned int length)
+{
+    make_samples(length);
+}
+
+static void run_window(unsigned int length)
+{
+    window(samples, real, imag, length);
+}
+
+static void setup_fft(unsigned int length)
+{
+    make_samples(length);
+    window(samples, real, imag, length);
+}
+
+static void run_fft(unsigned int length)
+{
+    fft(real, imag, length);
+}
+
+/* As measure() does it, with the default limit. */
+static void run_fft_pruned(unsigned int length)
+{
+    fft_pruned(real, imag, length, length / 4);
+}
+
+static void setup_polar(unsigned int length)
+{
+    setup_fft(length);
+    fft(real, imag, length);
+}
+
+static void run_polar(unsigned int length)
+{
+    make_polar(real, imag, real, imag, length / 2 + 1);
+}
+
+static void setup_spectrum(unsigned int length)
+{
+    setup_polar(length);
+    make_polar(real, imag, real, imag, length / 2 + 1);
+}
+
+static void run_peak(unsigned int length)
+{
+    peak(real, length / 2 + 1);
+}
+
+static void run_graph_logx(unsigned int length)
+{
+    graph_draw_logx(frame, real, length / 2 + 1);
+}
+
+static void setup_none(unsigned int length)
+{
+    (void) length;
+}
+
+static void run_sample(unsigned int length)
+{
+    sample(length, 500e3, samples);
+}
+
+static const struct kernel kernels[] = {
+    { "window", setup_window, run_window },
+    { "fft", setup_fft, run_fft },
+    { "fft_pruned", setup_fft, run_fft_pruned },
+    { "make_polar", setup_polar, run_polar },
+    { "peak", setup_spectrum, run_peak },
+    { "graph_logx", setup_spectrum, run_graph_logx },
+    { "sample", setup_none, run_sample },
+    { NULL, NULL, NULL },
+};
+
+/* Empty the XIP cache, so the next call has to fetch
+ * all its code from flash again. */
+static void flush_cache(void)
+{
+    xip_ctrl_hw->flush = 1;
+    /* Reading it back waits for the flush to finish. */
+    (void) xip_ctrl_hw->flush;
+}
+
+/* Time @k at @length, and print the result. */
+static void bench(const struct kernel *k, unsigned int length, bool cold)
+{
+    uint64_t total_us = 0, total_cycles = 0;
+    unsigned int calls = 0;
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+
+    if (!cold) {
+        k->setup(length);
+        k->run(length);
+    }
+    while (calls < MAX_CALLS && total_us < MIN_TOTAL_US) {
+        k->setup(length);
+        if (cold) {
+            flush_cache();
+        }
+
+        /* SysTick counts down. */
+        systick_hw->cvr = 0;
+        uint32_t start_ticks = systick_hw->cvr;
+        uint64_t start_us = time_us_64();
+        k->run(length);
+        uint32_t end_ticks = systick_hw->cvr;
+        uint64_t us = time_us_64() - start_us;
+
+        total_us += us;
+        if (us < SYSTICK_MAX_US) {
+            total_cycles += (start_ticks - end_ticks) & 0xffffffu;
+        } else {
+            total_cycles += us * mhz;
+        }
+        calls++;
+    }
+
+    printf("BENCH,%s,%s,%u,%s,%u,%llu,%.1f\n",
+           BENCH_PLACEMENT, k->name, length, cold ? "cold" : "warm", calls,
+           (unsigned long long)(total_cycles / calls),
+           (double) total_us / calls);
+}
+
+int main(void)
+{
+    /* Debugging metadata that gets baked into the binary. */
+    bi_decl(bi_program_name("bench"));
+    bi_decl(bi_program_version_string("1.0"));
+    bi_decl(bi_program_description("Kernel benchmarks for flicker"));
+
+    /* Output will go to the USB console. */
+    stdio_init_all();
+
+    /* Hardware setup. */
+    gpio_init(PICO_DEFAULT_LED_PIN);
+    gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
+    sample_init(PT_PIN);
+
+    /* Run SysTick from the processor clock, over its full range. */
+    systick_hw->rvr = 0xffffff;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS |
+                      M0PLUS_SYST_CSR_ENABLE_BITS;
+
+    while (1) {
+        gpio_put(PICO_DEFAULT_LED_PIN, 1);
+        printf("Starting benchmarks at %luMHz.\n",
+               (unsigned long)(clock_get_hz(clk_sys) / 1000000));
+        printf("BENCH,placement,kernel,length,cache,calls,cycles,us\n");
+
+        for (const struct kernel *k = kernels; k->name; k++) {
+            for (unsigned int length = 256; length <= MAX_LENGTH; length *= 4) {
+                bench(k, length, false);
+                bench(k, length, true);
+            }
+        }
+
+        printf("Benchmarks complete.\n\n");
+        gpio_put(PICO_DEFAULT_LED_PIN, 0);
+        sleep_ms(10000);
+    }
+}
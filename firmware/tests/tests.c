@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "pico/float.h"
@@ -55,6 +56,66 @@ static bool fft_match(const float *ours,
     return (errors == 0);
 }
 
+/* Where peak() would put the peak of @magnitudes, worked out the
+ * slow way with the double-precision maths library. */
+static double reference_peak(const float *magnitudes, unsigned int count)
+{
+    unsigned int i, max_index = 1;
+    for (i = 1; i < count; i++) {
+        if (magnitudes[i] > magnitudes[max_index]) {
+            max_index = i;
+        }
+    }
+    if (max_index == count - 1) {
+        return max_index;
+    }
+    /* A pure tone right on a bucket (like the square waves') has
+     * nothing either side of it.  The fit would give NaN. */
+    if (magnitudes[max_index - 1] == 0 && magnitudes[max_index + 1] == 0) {
+        return max_index;
+    }
+    double l = log(magnitudes[max_index - 1]);
+    double m = log(magnitudes[max_index]);
+    double h = log(magnitudes[max_index + 1]);
+    return max_index - (h - l) / (2 * (h + l - 2 * m));
+}
+
+/* Check that the fast maths in make_polar() and peak() give
+ * the same answers as the real thing for an FFT's output. */
+static void polar_test(unsigned int length,
+                       const float *real_reference,
+                       const float *imag_reference)
+{
+    static float exact[MAX_FFT_LENGTH / 2 + 1];
+    unsigned int count = length / 2 + 1, errors = 0;
+    float max = 0;
+
+    for (unsigned int i = 0; i < count; i++) {
+        exact[i] = hypot(real_reference[i], imag_reference[i]);
+        max = fmaxf(max, exact[i]);
+    }
+    memcpy(real, real_reference, count * sizeof *real);
+    memcpy(imag, imag_reference, count * sizeof *imag);
+    make_polar(real, imag, real, imag, count);
+
+    for (unsigned int i = 0; i < count && errors < 10; i++) {
+        float angle = atan2(imag_reference[i], real_reference[i]);
+        if (fabsf(real[i] - exact[i]) > exact[i] / 1e5 + max / 1e6 ||
+            (exact[i] > max / 1e3 && fabsf(imag[i] - angle) > 1e-5)) {
+            printf("%u: %f, %f != %f, %f\n",
+                   i, real[i], imag[i], exact[i], angle);
+            errors++;
+        }
+    }
+    ASSERT(errors == 0);
+
+    /* The peak is what we actually report, so it must agree closely. */
+    float ours = peak(real, count);
+    double theirs = reference_peak(exact, count);
+    printf("Peak %f (reference %f)\n", ours, theirs);
+    ASSERT(fabs(ours - theirs) < 1e-3);
+}
+
 /* Run an FFT and check that we got the same answer
  * that the python generator got. */
 static void fft_test(const char *name,
@@ -75,6 +136,18 @@ static void fft_test(const char *name,
     ASSERT(fft_match(real, real_reference, length));
     ASSERT(fft_match(imag, imag_reference, length));
 
+    /* The pruned FFT should get the same answers for the buckets
+     * we ask for, as measure() does. */
+    memcpy(real, real_input, length * sizeof *real);
+    memset(imag, 0, length * sizeof *imag);
+
+    fft_pruned(real, imag, length, length / 4);
+
+    ASSERT(fft_match(real, real_reference, length / 4));
+    ASSERT(fft_match(imag, imag_reference, length / 4));
+
+    polar_test(length, real_reference, imag_reference);
+
     printf("FFT %s: %s\n", name, failed ? "FAILED" : "OK");
 }
 
@@ -89,7 +162,8 @@ static void sample_test(unsigned int count, float hz, bool print)
     failed = false;
 
     memset(samples, 0, count * sizeof *samples);
-    sample(count, hz, samples);
+    struct sample_stats stats = sample(count, hz, samples);
+    uint32_t sum = 0;
     for (unsigned int i = 0; i < count; i++) {
         if (print) {
             printf("  %3d: 0x%04x\n", i, samples[i]);
@@ -98,7 +172,11 @@ static void sample_test(unsigned int count, float hz, bool print)
         ASSERT((samples[i] & SAMPLE_ERROR) == 0);
         /* No blanks. */
         ASSERT(samples[i] != 0);
+        sum += samples[i];
     }
+    /* The DMA sniffer should agree. */
+    ASSERT(!stats.errors);
+    ASSERT(stats.sum == sum);
 
     printf("SAMPLE %d @%fHz: %s\n", count, hz, failed ? "FAILED" : "OK");
 }
@@ -131,6 +209,13 @@ static void window_test(void)
      * with the second half inverted. */
     bool ok = window(samples, real, imag, MAX_FFT_LENGTH);
     ASSERT(ok);
+    /* Given the sum, it should get the same answer. */
+    float first = real[0], middle = real[MAX_FFT_LENGTH / 2];
+    ok = window_sum(samples, 0x100 * MAX_FFT_LENGTH / 2,
+                    real, imag, MAX_FFT_LENGTH);
+    ASSERT(ok);
+    ASSERT(real[0] == first);
+    ASSERT(real[MAX_FFT_LENGTH / 2] == middle);
     /* Back into uint16s for plotting. */
     for (unsigned int i = 0; i < MAX_FFT_LENGTH; i++) {
         samples[i] = real[i] + 0x80;
@@ -140,6 +225,254 @@ static void window_test(void)
     printf("WINDOW: %s\n", failed ? "FAILED" : "OK");
 }
 
+/* Check that bad samples get filled in, and the sum with them. */
+static void repair_test(void)
+{
+    const unsigned int count = 1000;
+    uint32_t sum = 0, clean = 0;
+    printf("REPAIR\n");
+    failed = false;
+
+    /* A ramp, so a straight line across a gap puts back exactly
+     * what was there. */
+    for (unsigned int i = 0; i < count; i++) {
+        samples[i] = 1000 + 2 * i;
+        clean += samples[i];
+    }
+    /* One bad sample at each end, a run in the middle that can be
+     * repaired, and one that's too long. */
+    samples[0] |= SAMPLE_ERROR;
+    samples[count - 1] |= SAMPLE_ERROR;
+    for (unsigned int i = 300; i < 300 + REPAIR_MAX_RUN; i++) {
+        samples[i] |= SAMPLE_ERROR;
+    }
+    for (unsigned int i = 600; i < 601 + REPAIR_MAX_RUN; i++) {
+        samples[i] |= SAMPLE_ERROR;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    unsigned int errors = repair(samples, count, &sum);
+    ASSERT(errors == 2 + REPAIR_MAX_RUN + REPAIR_MAX_RUN + 1);
+    /* The ends are copies of their neighbours; the middle is exact. */
+    ASSERT(samples[0] == 1002);
+    ASSERT(samples[count - 1] == 1000 + 2 * (count - 2));
+    for (unsigned int i = 300; i < 300 + REPAIR_MAX_RUN; i++) {
+        ASSERT(samples[i] == 1000 + 2 * i);
+    }
+    /* The long run is left for window() to refuse. */
+    for (unsigned int i = 600; i < 601 + REPAIR_MAX_RUN; i++) {
+        ASSERT(samples[i] & SAMPLE_ERROR);
+    }
+    ASSERT(!window(samples, real, imag, count));
+
+    /* With that run put right, the sum matches: the copied ends are
+     * one step up and one step down from what was there. */
+    for (unsigned int i = 600; i < 601 + REPAIR_MAX_RUN; i++) {
+        sum -= samples[i];
+        samples[i] = 1000 + 2 * i;
+        sum += samples[i];
+    }
+    ASSERT(sum == clean);
+    ASSERT(repair(samples, count, NULL) == 0);
+
+    printf("REPAIR: %s\n", failed ? "FAILED" : "OK");
+}
+
+/* Check that folding cycles together recovers a clean waveform. */
+static void fold_test(void)
+{
+    static struct cycle cycle;
+    float period = 123.4f;
+    printf("FOLD\n");
+    failed = false;
+
+    /* A sine wave with a non-integer period, plus noise that
+     * averaging should mostly remove. */
+    srand(700);
+    for (unsigned int i = 0; i < SAMPLE_COUNT; i++) {
+        float noise = (rand() % 201) - 100;
+        samples[i] = roundf(2000 + 1000 * sinf(M_TWOPI * i / period) + noise);
+    }
+    bool ok = fold_cycles(samples, SAMPLE_COUNT, period, &cycle);
+    ASSERT(ok);
+    ASSERT(cycle.cycles == (unsigned int) (SAMPLE_COUNT / period));
+
+    /* Each bin is an average over ~80 samples so it should be within a
+     * few units of the clean sine at the middle of that bin, give or
+     * take the bin's own width. */
+    for (unsigned int bin = 0; bin < FOLD_BINS; bin++) {
+        float expected = 2000 + 1000 * sinf(M_TWOPI * (bin + 0.5f) / FOLD_BINS);
+        ASSERT(fabsf(cycle.mean[bin] - expected) < 40);
+        ASSERT(cycle.min[bin] <= cycle.mean[bin]);
+        ASSERT(cycle.max[bin] >= cycle.mean[bin]);
+    }
+    /* 1000 / 2000 = 50% modulation; the noise shouldn't move that. */
+    int mod = mod_percent(cycle.mean, FOLD_BINS);
+    printf("Folded %u cycles, %d%% flicker\n", cycle.cycles, mod);
+    ASSERT(mod >= 49 && mod <= 51);
+
+    /* Less than one cycle isn't enough. */
+    ok = fold_cycles(samples, 100, period, &cycle);
+    ASSERT(!ok);
+
+    printf("FOLD: %s\n", failed ? "FAILED" : "OK");
+}
+
+/* Check that zooming finds peaks more precisely than the FFT can. */
+static void zoom_test(void)
+{
+    const unsigned int count = 8192;
+    const float fundamental = 37.3f, harmonic = 2 * fundamental;
+    struct zoom peaks[2];
+    printf("ZOOM\n");
+    failed = false;
+
+    /* A tone between buckets, with a second harmonic. */
+    for (unsigned int i = 0; i < count; i++) {
+        samples[i] = roundf(2000
+            + 1000 * sinf(M_TWOPI * fundamental * i / count)
+            + 300 * sinf(M_TWOPI * harmonic * i / count + 1));
+    }
+
+    /* Start from the nearest buckets, as if from a rough guess. */
+    peaks[0].bucket = 37;
+    peaks[1].bucket = 75;
+    zoom(samples, count, peaks, 2);
+    printf("Fundamental %f (%f), harmonic %f (%f)\n",
+           peaks[0].bucket, peaks[0].magnitude,
+           peaks[1].bucket, peaks[1].magnitude);
+    ASSERT(fabsf(peaks[0].bucket - fundamental) < 0.01);
+    ASSERT(fabsf(peaks[1].bucket - harmonic) < 0.01);
+    /* Relative level should be 300/1000. */
+    ASSERT(fabsf(peaks[1].magnitude / peaks[0].magnitude - 0.3f) < 0.01);
+
+    printf("ZOOM: %s\n", failed ? "FAILED" : "OK");
+}
+
+/* Check that the harmonic series comes out at the right levels. */
+static void series_test(void)
+{
+    const unsigned int count = 4096;
+    const float fundamental = 37.3f;
+    struct series series;
+    printf("SERIES\n");
+    failed = false;
+
+    /* Harmonics falling off as 1/n^2, with nothing above the 8th. */
+    for (unsigned int i = 0; i < count; i++) {
+        float s = 2000;
+        for (unsigned int n = 1; n <= 8; n++) {
+            s += 1000.0f / (n * n) *
+                 sinf(M_TWOPI * n * fundamental * i / count + n);
+        }
+        samples[i] = roundf(s);
+    }
+    bool ok = window(samples, real, imag, count);
+    ASSERT(ok);
+    fft(real, imag, count);
+    make_polar(real, imag, real, imag, count / 2 + 1);
+    harmonic_series(real, count / 2 + 1, peak(real, count / 2 + 1), &series);
+
+    ASSERT(series.count == SERIES_MAX);
+    for (unsigned int n = 1; n <= series.count; n++) {
+        float db = 20 * log10f(series.harmonic[n - 1].magnitude /
+                               series.harmonic[0].magnitude);
+        printf("Harmonic %u at %f, %.2fdB\n",
+               n, series.harmonic[n - 1].bucket, db);
+        if (n <= 8) {
+            ASSERT(fabsf(series.harmonic[n - 1].bucket - n * fundamental)
+                   < 0.01f * n);
+            ASSERT(fabsf(db + 40 * log10f(n)) < 0.1f);
+        } else {
+            /* Just rounding noise. */
+            ASSERT(db < -60);
+        }
+    }
+
+    printf("SERIES: %s\n", failed ? "FAILED" : "OK");
+}
+
+/* Compare 8-bit samples with 12-bit ones: first the same synthetic
+ * waveform at both widths, then the real light. */
+static void narrow_test(void)
+{
+    static uint8_t narrow[MAX_FFT_LENGTH];
+    static struct cycle cycle;
+    const unsigned int count = MAX_FFT_LENGTH;
+    const float frequency = 37.3f, period = count / frequency;
+    float wide_bucket, narrow_bucket;
+    struct zoom wide_zoom, narrow_zoom;
+    int wide_mod, narrow_mod;
+    printf("NARROW\n");
+    failed = false;
+
+    /* A tone between buckets, plus a little noise. */
+    srand(800);
+    for (unsigned int i = 0; i < count; i++) {
+        float noise = (rand() % 41) - 20;
+        samples[i] = roundf(2000 + 1000 * sinf(M_TWOPI * i / period) + noise);
+        narrow[i] = samples[i] >> SAMPLE_NARROW_SHIFT;
+    }
+
+    /* Coarse frequency, zoomed-in frequency and flicker at 12 bits... */
+    bool ok = window(samples, real, imag, count);
+    ASSERT(ok);
+    fft(real, imag, count);
+    make_polar(real, imag, real, imag, count / 2 + 1);
+    wide_bucket = peak(real, count / 4);
+    wide_zoom.bucket = wide_bucket;
+    zoom(samples, count, &wide_zoom, 1);
+    ok = fold_cycles(samples, count, period, &cycle);
+    ASSERT(ok);
+    wide_mod = mod_percent(cycle.mean, FOLD_BINS);
+
+    /* ...and at 8 bits. */
+    window8(narrow, real, imag, count);
+    fft(real, imag, count);
+    make_polar(real, imag, real, imag, count / 2 + 1);
+    narrow_bucket = peak(real, count / 4);
+    narrow_zoom.bucket = narrow_bucket;
+    zoom8(narrow, count, &narrow_zoom, 1);
+    ok = fold_cycles8(narrow, count, period, &cycle);
+    ASSERT(ok);
+    narrow_mod = mod_percent(cycle.mean, FOLD_BINS);
+
+    printf("12-bit: peak %f, zoom %f (%f), %d%% flicker\n",
+           wide_bucket, wide_zoom.bucket, wide_zoom.magnitude, wide_mod);
+    printf(" 8-bit: peak %f, zoom %f (%f), %d%% flicker\n",
+           narrow_bucket, narrow_zoom.bucket, narrow_zoom.magnitude,
+           narrow_mod);
+
+    /* Dropping 4 bits of a 1000-unit swing should barely show. */
+    ASSERT(fabsf(narrow_bucket - wide_bucket) < 0.01);
+    ASSERT(fabsf(narrow_zoom.bucket - frequency) < 0.01);
+    ASSERT(fabsf(narrow_zoom.magnitude / wide_zoom.magnitude - 1) < 0.01);
+    ASSERT(abs(narrow_mod - wide_mod) <= 1);
+
+    /* Real samples should read the same at both widths, to within
+     * the 8-bit step.  They're two separate captures, so spread each
+     * over 20ms to average out the same mains ripple in both. */
+    float wide_mean = 0, narrow_mean = 0, hz = count / 20e-3f;
+    uint32_t narrow_sum = 0;
+    sample(count, hz, samples);
+    struct sample_stats stats = sample8(count, hz, narrow);
+    for (unsigned int i = 0; i < count; i++) {
+        ASSERT((samples[i] & SAMPLE_ERROR) == 0);
+        wide_mean += samples[i];
+        narrow_mean += narrow[i] << SAMPLE_NARROW_SHIFT;
+        narrow_sum += narrow[i] << SAMPLE_NARROW_SHIFT;
+    }
+    ASSERT(stats.sum == narrow_sum);
+    wide_mean /= count;
+    narrow_mean /= count;
+    printf("Light level: 12-bit %f, 8-bit %f\n", wide_mean, narrow_mean);
+    ASSERT(fabsf(narrow_mean - wide_mean) < 2 << SAMPLE_NARROW_SHIFT);
+
+    printf("NARROW: %s\n", failed ? "FAILED" : "OK");
+}
+
 /* Measure the average level over 20ms to smooth out the
  * most common 100Hz ripple. */
 static float average_sample(void)
@@ -238,6 +571,16 @@ int main(void)
 
         window_test();
 
+        repair_test();
+
+        fold_test();
+
+        zoom_test();
+
+        series_test();
+
+        narrow_test();
+
         agc_test();
 
         printf("Tests complete.\n\n");
@@ -0,0 +1,346 @@
+/* Run the firmware's AGC control law against a simulated sensing
+ * circuit, for lots of made-up light sources, and report how quickly
+ * it settles.  This is for tuning AGC_TARGET, AGC_CEILING and
+ * agc_step() with numbers rather than by waving lamps at a meter.
+ *
+ * The circuit: the phototransistor passes a current proportional to
+ * the light, into the AD5220 plus FIXED_OHMS (the AGC_OHMS() model).
+ * The voltage is V = IR until it nears the 3V3 rail, where the
+ * transistor saturates and the current is limited by the resistor
+ * instead.  The ADC adds a small offset and noise, and clips at 4095.
+ *
+ * Each scenario is a light with a random brightness, flicker shape,
+ * frequency and depth; some also change brightness part way through
+ * the AGC run, like a lamp warming up or a dimmer being turned.
+ * Each AGC round measures the peak over AGC_SAMPLE_COUNT samples at
+ * AGC_SAMPLE_RATE, exactly as agc_run() does, then calls agc_step().
+ *
+ * Usage: agc-sim [options]
+ *   -n COUNT  number of scenarios (default 5000)
+ *   -r ROUNDS most AGC rounds to try (default 16)
+ *   -t PCT    how close to AGC_TARGET counts as settled (default 15)
+ *   -s SEED   random seed (default 1)
+ *   -v        print every scenario, as CSV
+ *
+ * A scenario has settled at round R if the measurement that follows
+ * R rounds, and every one after it, is within the tolerance.  Lights
+ * that no potentiometer setting can bring within the tolerance (too
+ * bright or too dark for the circuit) are counted separately, since
+ * no control law could do better for them. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "agc.h"
+
+/* The circuit. */
+#define RAIL_VOLTS 3.3
+#define SATURATION_VOLTS 3.1    /* Where the phototransistor runs out. */
+#define KNEE 4.0                /* How sharply it does. */
+#define ADC_OFFSET 8.0          /* Counts read at zero light. */
+#define ADC_NOISE 3.0           /* Peak noise, counts. */
+
+/* Peak phototransistor currents we try, amps.  The circuit can only
+ * reach AGC_TARGET between about 0.2mA and 3mA, so this spans lights
+ * it can't handle at both ends. */
+#define MIN_AMPS 50e-6
+#define MAX_AMPS 6e-3
+
+/* Potentiometer steps are quick; sampling is what takes the time. */
+#define ROUND_MS (1000.0 * AGC_SAMPLE_COUNT / AGC_SAMPLE_RATE)
+
+#define MAX_ROUNDS 64
+
+enum shape { SINE, SQUARE, SAWTOOTH, PULSE, SHAPES };
+static const char *shape_names[SHAPES] = {
+    "sine", "square", "sawtooth", "pulse",
+};
+
+struct scenario {
+    enum shape shape;
+    double amps;            /* Peak current at full brightness. */
+    double frequency;       /* Flicker frequency, Hz. */
+    double depth;           /* How far it dips, 0 to 1. */
+    double duty;            /* Fraction of each cycle that's bright. */
+    double step_ms;         /* When the brightness changes, or 0. */
+    double step_factor;     /* ...and by how much. */
+};
+
+static unsigned int scenario_count = 5000;
+static unsigned int max_rounds = 16;
+static double tolerance = 0.15;
+static uint64_t seed = 1;
+static bool verbose;
+
+/* xorshift64*: quick, and the same everywhere for a given seed. */
+static uint64_t rng_state;
+
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545f4914f6cdd1dull >> 11) * 0x1.0p-53;
+}
+
+static double log_uniform(double low, double high)
+{
+    return low * exp(uniform() * log(high / low));
+}
+
+/* Make up a light. */
+static void invent(struct scenario *s)
+{
+    s->shape = uniform() * SHAPES;
+    s->amps = log_uniform(MIN_AMPS, MAX_AMPS);
+    s->frequency = log_uniform(50, 50000);
+    s->depth = uniform();
+    s->duty = (s->shape == PULSE) ? log_uniform(0.01, 0.2) : 0.5;
+    s->step_ms = 0;
+    s->step_factor = 1;
+    if (uniform() < 0.25) {
+        s->step_ms = uniform() * 3 * ROUND_MS;
+        s->step_factor = log_uniform(0.5, 2);
+    }
+}
+
+/* Brightness at time @t seconds, as a phototransistor current. */
+static double current(const struct scenario *s, double t)
+{
+    double phase = s->frequency * t;
+    double level;
+
+    phase -= floor(phase);
+    switch (s->shape) {
+    case SINE:
+        level = 1 - s->depth * (0.5 - 0.5 * cos(2 * M_PI * phase));
+        break;
+    case SAWTOOTH:
+        level = 1 - s->depth * phase;
+        break;
+    default:
+        level = (phase < s->duty) ? 1 : 1 - s->depth;
+        break;
+    }
+    if (s->step_ms && t * 1000 >= s->step_ms) {
+        level *= s->step_factor;
+    }
+    return s->amps * level;
+}
+
+/* What the ADC reads for current @amps at potentiometer @level. */
+static double adc_counts(double amps, unsigned int level)
+{
+    double volts = amps * AGC_OHMS(level);
+    volts /= pow(1 + pow(volts / SATURATION_VOLTS, KNEE), 1 / KNEE);
+    double counts = volts / RAIL_VOLTS * 4096 + ADC_OFFSET;
+    return (counts > 4095) ? 4095 : counts;
+}
+
+/* One measure_peak(): the brightest of AGC_SAMPLE_COUNT samples
+ * starting at time @start.  The circuit only ever gets brighter with
+ * more light, so we just need the brightest sample; but we do need to
+ * look at each one, because a short pulse can fall between samples. */
+static uint16_t measure_peak(const struct scenario *s,
+                             double start,
+                             unsigned int level)
+{
+    double brightest = 0;
+    for (unsigned int i = 0; i < AGC_SAMPLE_COUNT; i++) {
+        double amps = current(s, start + (double) i / AGC_SAMPLE_RATE);
+        if (amps > brightest) {
+            brightest = amps;
+        }
+    }
+    double counts = adc_counts(brightest, level) +
+                    ADC_NOISE * (2 * uniform() - 1);
+    return (counts < 0) ? 0 : (counts > 4095) ? 4095 : counts;
+}
+
+static bool settled(uint16_t peak)
+{
+    return abs(peak - AGC_TARGET) <= tolerance * AGC_TARGET;
+}
+
+/* Could any potentiometer setting bring this light within tolerance,
+ * once it's stopped changing? */
+static bool reachable(const struct scenario *s)
+{
+    double amps = s->amps * s->step_factor;
+    for (unsigned int level = 0; level < 128; level++) {
+        if (fabs(adc_counts(amps, level) - AGC_TARGET) <=
+            tolerance * AGC_TARGET) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Results. */
+static unsigned long settled_after[MAX_ROUNDS + 1];
+static unsigned long unreachable, unsettled;
+static unsigned long clipped;   /* Reachable, but still too bright
+                                   after AGC_ROUNDS. */
+static double total_ms;
+static unsigned long total_settled;
+
+/* Run the AGC on one light.  Returns the round it settled
+ * after, or -1 if it never did. */
+static int run(const struct scenario *s,
+               unsigned int *final_level,
+               bool *clipping)
+{
+    uint16_t peaks[MAX_ROUNDS + 1];
+    unsigned int level = 127;   /* Where agc_reset() leaves it. */
+    double t = uniform() / s->frequency;
+    int settled_round = -1;
+
+    /* peaks[r] is what we see after r rounds of adjustment. */
+    for (unsigned int r = 0; r <= max_rounds; r++) {
+        peaks[r] = measure_peak(s, t, level);
+        t += ROUND_MS / 1000;
+        if (r == AGC_ROUNDS) {
+            *clipping = peaks[r] > AGC_CEILING;
+        }
+        if (r < max_rounds) {
+            level = agc_step(level, peaks[r]);
+        }
+    }
+    *final_level = level;
+
+    for (int r = max_rounds; r >= 0 && settled(peaks[r]); r--) {
+        settled_round = r;
+    }
+    return settled_round;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: agc-sim [-n COUNT] [-r ROUNDS] [-t PCT] [-s SEED] [-v]\n");
+    exit(2);
+}
+
+/* @arg as a number from @min to @max, or the usage message if it
+ * isn't one. */
+static unsigned long number(const char *arg, unsigned long min,
+                            unsigned long max)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(arg, &end, 0);
+    if (!isdigit((unsigned char) *arg) || *end || errno ||
+        n < min || n > max) {
+        usage();
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    struct scenario s;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:t:s:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            scenario_count = number(optarg, 1, UINT_MAX);
+            break;
+        case 'r':
+            max_rounds = number(optarg, 1, MAX_ROUNDS);
+            break;
+        case 't':
+            tolerance = atof(optarg) / 100;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || scenario_count == 0 || tolerance <= 0) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    if (verbose) {
+        printf("shape,amps,frequency,depth,duty,step_ms,step_factor,"
+               "reachable,settled_round,final_level\n");
+    }
+    for (unsigned int n = 0; n < scenario_count; n++) {
+        unsigned int level;
+        bool clipping = false;
+        invent(&s);
+        bool ok = reachable(&s);
+        int r = run(&s, &level, &clipping);
+
+        if (!ok) {
+            unreachable++;
+        } else if (r < 0) {
+            unsettled++;
+        } else {
+            if (clipping) {
+                clipped++;
+            }
+            settled_after[r]++;
+            total_settled++;
+            total_ms += r * ROUND_MS;
+        }
+        if (verbose) {
+            printf("%s,%g,%g,%.3f,%.3f,%.1f,%.3f,%d,%d,%u\n",
+                   shape_names[s.shape], s.amps, s.frequency, s.depth,
+                   s.duty, s.step_ms, s.step_factor, ok, r, level);
+        }
+    }
+
+    unsigned long reached = scenario_count - unreachable;
+    unsigned long cumulative = 0;
+    long p50 = -1, p95 = -1, p99 = -1;
+    fprintf(stderr, "%u scenarios: %lu out of the circuit's range, "
+            "%lu reachable\n", scenario_count, unreachable, reached);
+    fprintf(stderr, "target %d +/- %.0f%%, firmware runs %d rounds "
+            "of %.0fms\n",
+            AGC_TARGET, tolerance * 100, AGC_ROUNDS, ROUND_MS);
+    fprintf(stderr, "rounds  settled  cumulative\n");
+    for (unsigned int r = 0; r <= max_rounds; r++) {
+        cumulative += settled_after[r];
+        if (settled_after[r]) {
+            fprintf(stderr, "%6u  %7lu  %9.1f%%\n", r, settled_after[r],
+                    reached ? 100.0 * cumulative / reached : 0);
+        }
+        if (p50 < 0 && cumulative * 2 >= reached) {
+            p50 = r;
+        }
+        if (p95 < 0 && cumulative * 20 >= reached * 19) {
+            p95 = r;
+        }
+        if (p99 < 0 && cumulative * 100 >= reached * 99) {
+            p99 = r;
+        }
+    }
+    fprintf(stderr, "never settled in %u rounds: %lu\n",
+            max_rounds, unsettled);
+    fprintf(stderr, "still clipping after %d rounds: %lu\n",
+            AGC_ROUNDS, clipped);
+    if (total_settled) {
+        fprintf(stderr, "mean capture time to settle: %.1fms\n",
+                total_ms / total_settled);
+    }
+    /* -1 means never, in the rounds we tried. */
+    fprintf(stderr, "rounds for 50%%/95%%/99%% of reachable lights: "
+            "%ld/%ld/%ld (%.0f/%.0f/%.0fms)\n",
+            p50, p95, p99, p50 * ROUND_MS, p95 * ROUND_MS, p99 * ROUND_MS);
+    return 0;
+}
@@ -0,0 +1,609 @@
+/* Collect measurements from a fleet of flicker meters.
+ *
+ * Each meter is a USB CDC serial port that prints a human-readable
+ * report per measurement (see the README).  We open all of them at
+ * once, pick the numbers out of the reports, and write one JSON line
+ * per measurement to a rotating log file or a local datagram socket.
+ *
+ * Usage: flicker-collector [options] DEVICE...
+ *   -o FILE   append records to FILE (default: stdout)
+ *   -r BYTES  rotate FILE when it grows past BYTES
+ *   -k COUNT  keep COUNT rotated files (FILE.1 is the newest; with 0,
+ *             FILE just starts again empty)
+ *   -s PATH   send records as datagrams to the unix socket at PATH
+ *   -q COUNT  queue at most COUNT records per device
+ *
+ * Backpressure: every device has its own short queue of records.
+ * The sink drains the queues round-robin so that one chatty meter
+ * can't starve the rest.  When a device's queue fills up (because the
+ * socket reader is slow or gone) we stop reading that device until
+ * the queue drains, and the kernel's tty buffer takes up the slack. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Longest report line we care about; the graphs are 80 columns. */
+#define LINE_MAX_BYTES 256u
+
+/* Longest formatted record. */
+#define RECORD_MAX_BYTES 512u
+
+/* Default per-device queue length, in records. */
+#define DEFAULT_QUEUE 16u
+
+/* How often we retry devices and sockets that went away. */
+#define RETRY_SECONDS 1
+
+/* epoll tags for our own (non-device) file descriptors. */
+#define TAG_SIGNAL ((uint64_t) -1)
+#define TAG_TIMER ((uint64_t) -2)
+#define TAG_SINK ((uint64_t) -3)
+
+/* One measurement, assembled from several report lines. */
+struct measurement {
+    int agc_level;          /* -1 until we see the AGC line. */
+    const char *agc_status;
+    double frequency;       /* -1 until we see the FFT lines. */
+    double magnitude;
+    int window_ms;
+    int flicker;
+    unsigned int repaired;  /* Bad samples the meter filled in. */
+    double thd;             /* Percent, -1 if the meter didn't say. */
+};
+
+struct device {
+    const char *path;
+    int fd;                 /* -1 while the device is missing. */
+    bool paused;            /* Not reading: our queue is full. */
+
+    /* Partial input line. */
+    char line[LINE_MAX_BYTES];
+    unsigned int line_len;
+    bool line_overflow;
+
+    /* Measurement in progress. */
+    struct measurement m;
+
+    /* Queue of formatted records waiting for the sink. */
+    char (*queue)[RECORD_MAX_BYTES];
+    unsigned int head, count;
+
+    /* Statistics, reported on SIGUSR1. */
+    unsigned long records, errors, drops, reopens;
+};
+
+static struct device *devices;
+static unsigned int device_count;
+static unsigned int queue_length = DEFAULT_QUEUE;
+
+/* Round-robin position for draining the queues. */
+static unsigned int next_drain;
+
+/* Output: either a (rotating) file or a datagram socket. */
+static const char *out_path;
+static FILE *out_file;
+static off_t out_size;
+static off_t rotate_bytes;
+static unsigned int rotate_keep = 5;
+static const char *socket_path;
+static int sock = -1;
+static bool sink_blocked;
+
+static int epfd;
+
+/* Print an error and exit. */
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+/* Reset a measurement to "nothing seen yet". */
+static void measurement_clear(struct measurement *m)
+{
+    m->agc_level = -1;
+    m->agc_status = "ok";
+    m->frequency = -1;
+    m->magnitude = -1;
+    m->window_ms = -1;
+    m->flicker = -1;
+    m->repaired = 0;
+    m->thd = -1;
+}
+
+/* Start or stop listening to a device. */
+static void device_watch(struct device *d, bool in)
+{
+    struct epoll_event ev = {
+        .events = in ? EPOLLIN : 0,
+        .data.u64 = d - devices,
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, d->fd, &ev) < 0) {
+        die("epoll_ctl");
+    }
+    d->paused = !in;
+}
+
+/* Open a serial device in raw mode and start listening to it. */
+static bool device_open(struct device *d)
+{
+    struct termios tio;
+    int fd = open(d->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.u64 = d - devices,
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        die("epoll_ctl");
+    }
+    d->fd = fd;
+    /* Its queue may still be full from before it went away, in which
+     * case it stays paused until the sink catches up. */
+    device_watch(d, d->count < queue_length);
+    d->line_len = 0;
+    d->line_overflow = false;
+    measurement_clear(&d->m);
+    return true;
+}
+
+/* The device went away: forget it until the retry timer finds it. */
+static void device_close(struct device *d)
+{
+    fprintf(stderr, "%s: closed\n", d->path);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+    close(d->fd);
+    d->fd = -1;
+    d->reopens++;
+}
+
+/* Write @s as a JSON string, escaping anything awkward. */
+static int json_string(char *buf, size_t size, const char *s)
+{
+    size_t n = 0;
+    if (n < size) buf[n] = '"';
+    n++;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            if (n < size) buf[n] = '\\';
+            n++;
+        } else if (c < 0x20) {
+            c = '?';
+        }
+        if (n < size) buf[n] = c;
+        n++;
+    }
+    if (n < size) buf[n] = '"';
+    n++;
+    if (size > 0) {
+        buf[n < size ? n : size - 1] = '\0';
+    }
+    return n;
+}
+
+/* A report is complete: timestamp it and queue a record. */
+static void device_emit(struct device *d)
+{
+    struct timespec now;
+    struct tm tm;
+    char stamp[32], name[128];
+    struct measurement *m = &d->m;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    gmtime_r(&now.tv_sec, &tm);
+    strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &tm);
+    json_string(name, sizeof name, d->path);
+
+    /* Queue full?  We stop reading as soon as it fills, so this
+     * can only be the rest of a buffer we'd already read.  Drop the
+     * oldest record: newer measurements are more useful. */
+    if (d->count == queue_length) {
+        d->head = (d->head + 1) % queue_length;
+        d->count--;
+        d->drops++;
+    }
+    char *rec = d->queue[(d->head + d->count) % queue_length];
+    snprintf(rec, RECORD_MAX_BYTES,
+             "{\"time\":\"%s.%03ldZ\",\"device\":%s,\"agc\":%d,"
+             "\"agc_status\":\"%s\",\"frequency\":%.3f,"
+             "\"magnitude\":%.1f,\"window_ms\":%d,\"flicker\":%d,"
+             "\"repaired\":%u,\"thd\":%.1f}\n",
+             stamp, now.tv_nsec / 1000000, name, m->agc_level,
+             m->agc_status, m->frequency, m->magnitude,
+             m->window_ms, m->flicker, m->repaired, m->thd);
+    d->count++;
+    d->records++;
+
+    if (d->count == queue_length && !d->paused) {
+        device_watch(d, false);
+    }
+    measurement_clear(m);
+}
+
+/* Pick the numbers out of one line of a meter's report. */
+static void device_parse(struct device *d, char *line)
+{
+    struct measurement *m = &d->m;
+    unsigned int level, ms, count;
+    int percent;
+    double value;
+    char status[16];
+
+    if (sscanf(line, "AGC: %u/127 (TOO %15[A-Z])", &level, status) == 2) {
+        m->agc_level = level;
+        m->agc_status = !strcmp(status, "BRIGHT") ? "bright" : "dark";
+    } else if (sscanf(line, "AGC: %u/127", &level) == 1) {
+        m->agc_level = level;
+        m->agc_status = "ok";
+    } else if (sscanf(line, "Repaired %u bad samples.", &count) == 1) {
+        m->repaired = count;
+    } else if (sscanf(line, "FFT: peak at %lfHz", &value) == 1) {
+        m->frequency = value;
+    } else if (sscanf(line, "FFT: peak magnitude %lf", &value) == 1) {
+        m->magnitude = value;
+    } else if (sscanf(line, "Harmonics: THD %lf%%", &value) == 1) {
+        m->thd = value;
+    } else if (sscanf(line, "Raw samples: %ums, %d%% flicker.",
+                      &ms, &percent) == 2) {
+        /* This is always the last line of a report. */
+        m->window_ms = ms;
+        m->flicker = percent;
+        device_emit(d);
+    } else if (!strncmp(line, "Sampling error", 14)) {
+        /* The meter abandoned this measurement: too many bad
+         * samples to repair. */
+        d->errors++;
+        measurement_clear(m);
+    }
+    /* Anything else is graphs or chatter. */
+}
+
+/* Read whatever the device has for us and split it into lines. */
+static void device_read(struct device *d)
+{
+    char buf[4096];
+
+    while (!d->paused) {
+        ssize_t n = read(d->fd, buf, sizeof buf);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            device_close(d);
+            return;
+        }
+        if (n < 0) {
+            return;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\n' || c == '\r') {
+                if (d->line_len > 0 && !d->line_overflow) {
+                    d->line[d->line_len] = '\0';
+                    device_parse(d, d->line);
+                }
+                d->line_len = 0;
+                d->line_overflow = false;
+            } else if (d->line_len < LINE_MAX_BYTES - 1) {
+                d->line[d->line_len++] = c;
+            } else {
+                d->line_overflow = true;
+            }
+        }
+    }
+}
+
+/* (Re)connect the datagram socket to its reader. */
+static void sink_connect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        sink_blocked = true;
+    } else {
+        sink_blocked = false;
+    }
+}
+
+/* Move the log file aside: FILE -> FILE.1 -> FILE.2 ... */
+static void sink_rotate(void)
+{
+    char from[4096], to[4096];
+
+    fclose(out_file);
+    for (unsigned int i = rotate_keep; i > 0; i--) {
+        if (i > 1) {
+            snprintf(from, sizeof from, "%s.%u", out_path, i - 1);
+        } else {
+            snprintf(from, sizeof from, "%s", out_path);
+        }
+        snprintf(to, sizeof to, "%s.%u", out_path, i);
+        rename(from, to);
+    }
+    /* With nothing kept, FILE wasn't renamed away: empty it. */
+    out_file = fopen(out_path, rotate_keep ? "a" : "w");
+    if (!out_file) {
+        die(out_path);
+    }
+    out_size = 0;
+}
+
+/* Send one record.  Returns false if the sink can't take it yet. */
+static bool sink_write(const char *rec)
+{
+    size_t len = strlen(rec);
+
+    if (sock >= 0) {
+        if (send(sock, rec, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                /* Reader went away; the timer will reconnect. */
+                sink_blocked = true;
+                return false;
+            }
+            /* Reader is slow; wait until the socket is writable. */
+            struct epoll_event ev = {
+                .events = EPOLLOUT,
+                .data.u64 = TAG_SINK,
+            };
+            epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &ev);
+            sink_blocked = true;
+            return false;
+        }
+        return true;
+    }
+
+    if (rotate_bytes > 0 && out_size + (off_t) len > rotate_bytes) {
+        sink_rotate();
+    }
+    fputs(rec, out_file);
+    out_size += len;
+    return true;
+}
+
+/* Drain the device queues into the sink, one record per device
+ * per round, until they're empty or the sink pushes back. */
+static void sink_drain(void)
+{
+    bool progress = true;
+
+    while (progress && !sink_blocked) {
+        progress = false;
+        for (unsigned int n = 0; n < device_count && !sink_blocked; n++) {
+            struct device *d = &devices[next_drain];
+            next_drain = (next_drain + 1) % device_count;
+            if (d->count == 0) {
+                continue;
+            }
+            if (!sink_write(d->queue[d->head])) {
+                break;
+            }
+            d->head = (d->head + 1) % queue_length;
+            d->count--;
+            progress = true;
+
+            /* Resume reading once there's room for a burst. */
+            if (d->paused && d->fd >= 0 && d->count <= queue_length / 2) {
+                device_watch(d, true);
+            }
+        }
+    }
+    if (out_file) {
+        fflush(out_file);
+    }
+}
+
+/* Report per-device statistics on stderr. */
+static void print_stats(void)
+{
+    for (unsigned int i = 0; i < device_count; i++) {
+        struct device *d = &devices[i];
+        fprintf(stderr, "%s: %s, %lu records, %lu errors, %lu dropped, "
+                "%lu reopens, %u queued%s\n",
+                d->path, d->fd < 0 ? "missing" : "open", d->records,
+                d->errors, d->drops, d->reopens, d->count,
+                d->paused ? " (paused)" : "");
+    }
+}
+
+/* Make sure we can open a file per meter. */
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-o FILE [-r BYTES] [-k COUNT] | -s SOCKET] "
+            "[-q COUNT] DEVICE...\n", argv0);
+    exit(2);
+}
+
+/* @arg as a number from @min to @max, or the usage message if it
+ * isn't one. */
+static unsigned long long number(const char *argv0, const char *arg,
+                                 unsigned long long min,
+                                 unsigned long long max)
+{
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 0);
+    if (!isdigit((unsigned char) *arg) || *end || errno ||
+        n < min || n > max) {
+        usage(argv0);
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    struct epoll_event ev, events[64];
+    sigset_t sigs;
+
+    while ((opt = getopt(argc, argv, "o:r:k:s:q:")) != -1) {
+        switch (opt) {
+        case 'o': out_path = optarg; break;
+        case 'r': rotate_bytes = number(argv[0], optarg, 1, LLONG_MAX); break;
+        case 'k': rotate_keep = number(argv[0], optarg, 0, 1000); break;
+        case 's': socket_path = optarg; break;
+        case 'q': queue_length = number(argv[0], optarg, 2, 65536); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || (out_path && socket_path)) {
+        usage(argv[0]);
+    }
+
+    raise_fd_limit();
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        die("epoll_create1");
+    }
+
+    /* Signals arrive through the event loop too. */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    int sigfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    ev = (struct epoll_event) { .events = EPOLLIN, .data.u64 = TAG_SIGNAL };
+    if (sigfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev) < 0) {
+        die("signalfd");
+    }
+
+    /* Periodic retries for missing devices and socket readers. */
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec period = {
+        .it_interval = { .tv_sec = RETRY_SECONDS },
+        .it_value = { .tv_sec = RETRY_SECONDS },
+    };
+    ev = (struct epoll_event) { .events = EPOLLIN, .data.u64 = TAG_TIMER };
+    if (timerfd < 0 || timerfd_settime(timerfd, 0, &period, NULL) < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev) < 0) {
+        die("timerfd");
+    }
+
+    /* Output. */
+    if (socket_path) {
+        sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ev = (struct epoll_event) { .events = 0, .data.u64 = TAG_SINK };
+        if (sock < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+            die("socket");
+        }
+        sink_connect();
+    } else if (out_path) {
+        struct stat st;
+        out_file = fopen(out_path, "a");
+        if (!out_file) {
+            die(out_path);
+        }
+        out_size = (fstat(fileno(out_file), &st) == 0) ? st.st_size : 0;
+    } else {
+        out_file = stdout;
+    }
+
+    /* Devices. */
+    device_count = argc - optind;
+    devices = calloc(device_count, sizeof *devices);
+    if (!devices) {
+        die("calloc");
+    }
+    for (unsigned int i = 0; i < device_count; i++) {
+        struct device *d = &devices[i];
+        d->path = argv[optind + i];
+        d->fd = -1;
+        d->queue = calloc(queue_length, sizeof *d->queue);
+        if (!d->queue) {
+            die("calloc");
+        }
+        if (!device_open(d)) {
+            fprintf(stderr, "%s: %s (will retry)\n", d->path, strerror(errno));
+        }
+    }
+
+    while (1) {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if (n < 0 && errno != EINTR) {
+            die("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == TAG_SIGNAL) {
+                struct signalfd_siginfo si;
+                while (read(sigfd, &si, sizeof si) == sizeof si) {
+                    if (si.ssi_signo == SIGUSR1) {
+                        print_stats();
+                    } else {
+                        sink_drain();
+                        print_stats();
+                        return 0;
+                    }
+                }
+            } else if (tag == TAG_TIMER) {
+                uint64_t ticks;
+                if (read(timerfd, &ticks, sizeof ticks) < 0) {
+                    /* Spurious wakeup; nothing to do. */
+                }
+                for (unsigned int j = 0; j < device_count; j++) {
+                    if (devices[j].fd < 0 && device_open(&devices[j])) {
+                        fprintf(stderr, "%s: opened\n", devices[j].path);
+                    }
+                }
+                if (sock >= 0 && sink_blocked) {
+                    sink_connect();
+                }
+            } else if (tag == TAG_SINK) {
+                /* Socket reader caught up; stop watching for that. */
+                ev = (struct epoll_event) { .events = 0, .data.u64 = TAG_SINK };
+                epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &ev);
+                sink_blocked = false;
+            } else {
+                struct device *d = &devices[tag];
+                if (d->fd < 0) {
+                    continue;
+                }
+                if (events[i].events & EPOLLIN) {
+                    device_read(d);
+                } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    device_close(d);
+                }
+            }
+        }
+        sink_drain();
+    }
+}
@@ -0,0 +1,267 @@
+/* Run the firmware's display code against a stand-in for the OLED,
+ * which records what it's sent instead of showing it.
+ *
+ * Each made-up report goes through display_show() exactly as on the
+ * meter.  The stand-in applies each update to its own copy of the
+ * panel's memory, which must then match the whole frame drawn from
+ * scratch: so a page that changed but wasn't sent shows up here
+ * rather than as a smear on a real screen.  It also counts the bytes
+ * the SSD1306 driver would put on the I2C bus, to see what sending
+ * only the changes saves.  It can also lose updates, as a real panel
+ * that stops answering mid-transfer would, to check that the display
+ * puts itself right afterwards.
+ *
+ * Most reports are the same light as the one before, with a little
+ * noise, as when the meter is left pointing at one lamp; now and then
+ * it's pointed at a different one.
+ *
+ * Usage: display-record [options]
+ *   -n COUNT  number of reports (default 200)
+ *   -c PCT    percentage of reports that are a different light (default 5)
+ *   -s SEED   random seed (default 1)
+ *   -o PREFIX write the panel after each update to PREFIX0000.pbm, ...
+ *   -f PCT    percentage of updates that don't get there (default 0)
+ *
+ * Exits with status 1 if the panel ever didn't match. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "graph.h"
+#include "output.h"
+
+/* Spectrum and waveform sizes for the made-up reports. */
+#define BUCKETS 2049u
+#define SAMPLES 1000u
+
+/* I2C bytes per changed page, as ssd1306.c sends them: the address,
+ * column and page ranges, then the address and data control byte. */
+#define PAGE_OVERHEAD (1u + 7u + 1u + 1u)
+
+static unsigned int report_count = 200;
+static double change = 0.05;
+static uint64_t seed = 1;
+static const char *prefix;
+static double failures;
+
+/* xorshift64*: quick, and the same everywhere for a given seed. */
+static uint64_t rng_state;
+
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545f4914f6cdd1dull >> 11) * 0x1.0p-53;
+}
+
+/* The stand-in panel. */
+static struct display_frame panel;
+static unsigned long updates, pages_sent, bytes_sent, lost;
+
+/* Whether the last update was lost, which the driver finds out when
+ * it waits for it at the start of the next one; and how many more
+ * reports the panel can be wrong for: the one that was lost, and the
+ * one after it, sent as changes from a frame the panel never got. */
+static bool last_lost;
+static unsigned int recovering;
+
+/* The firmware's ASSERT()s end up here. */
+void assertion_failure(const char *pred, const char *file, int line)
+{
+    fprintf(stderr, "display-record: assertion failed at %s line %d: %s\n",
+            file, line, pred);
+    exit(2);
+}
+
+static bool record_init(void)
+{
+    return true;
+}
+
+/* Apply an update to the panel, and count what it would cost. */
+static bool record_update(const struct display_frame *frame,
+                          const struct display_span spans[DISPLAY_PAGES])
+{
+    bool ok = !last_lost;
+
+    updates++;
+    last_lost = failures > 0 && uniform() < failures;
+    if (last_lost) {
+        lost++;
+        recovering = 2;
+        return ok;
+    }
+    for (unsigned int p = 0; p < DISPLAY_PAGES; p++) {
+        unsigned int first = spans[p].first, last = spans[p].last;
+        if (first > last) {
+            continue;
+        }
+        memcpy(&panel.page[p][first], &frame->page[p][first],
+               last - first + 1);
+        pages_sent++;
+        bytes_sent += PAGE_OVERHEAD + last - first + 1;
+    }
+    return ok;
+}
+
+static const struct display_driver recorder = {
+    .init = record_init,
+    .update = record_update,
+};
+
+/* A light: a fundamental and its second harmonic. */
+struct light {
+    double bucket;          /* Fundamental, in FFT buckets. */
+    double depth;           /* Modulation, 0 to 1. */
+    double second;          /* Second harmonic, relative. */
+    unsigned int agc;
+};
+
+static void invent(struct light *l)
+{
+    l->bucket = 2 + uniform() * 200;
+    l->depth = uniform();
+    l->second = uniform() * 0.5;
+    l->agc = uniform() * 128;
+}
+
+/* Fill in a report on @l, with a little noise. */
+static void measure(const struct light *l, struct report *r)
+{
+    static float spectrum[BUCKETS];
+    static uint16_t samples[SAMPLES];
+    double hz_per_bucket = 250000.0 / ((BUCKETS - 1) * 2);
+    double jitter = 1 + (uniform() - 0.5) * 0.002;
+    double bucket = l->bucket * jitter;
+
+    memset(r, 0, sizeof *r);
+    for (unsigned int i = 0; i < BUCKETS; i++) {
+        double d1 = i - bucket, d2 = i - 2 * bucket;
+        spectrum[i] = 1e4 * l->depth * (exp(-d1 * d1 / 2) +
+                                        l->second * exp(-d2 * d2 / 2))
+                    + 20 * uniform();
+    }
+    graph_draw_logx(r->spectrum, spectrum, BUCKETS);
+
+    /* Two cycles. */
+    for (unsigned int i = 0; i < SAMPLES; i++) {
+        double phase = 4 * M_PI * i / SAMPLES;
+        samples[i] = 2000 * (1 - l->depth * (0.5 - 0.5 * cos(phase))
+                             + 0.3 * l->second * sin(2 * phase))
+                   + 1000 + 8 * uniform();
+    }
+    graph_draw(r->waveform, samples, SAMPLES);
+
+    r->frequency = bucket * hz_per_bucket;
+    r->magnitude = 1e4 * l->depth;
+    r->agc_level = l->agc;
+    r->flicker = round(100 * l->depth / (2 - l->depth) * jitter);
+    r->window_ms = 2000 / r->frequency;
+}
+
+/* Write the panel out as a PBM image. */
+static void save(unsigned int n)
+{
+    char name[4096];
+    snprintf(name, sizeof name, "%s%04u.pbm", prefix, n);
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        perror(name);
+        exit(2);
+    }
+    fprintf(f, "P1\n%u %u\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    for (unsigned int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (unsigned int x = 0; x < DISPLAY_WIDTH; x++) {
+            fputc((panel.page[y / 8][x] >> (y % 8) & 1) ? '1' : '0', f);
+        }
+        fputc('\n', f);
+    }
+    fclose(f);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: display-record [-n COUNT] [-c PCT] [-s SEED] "
+            "[-o PREFIX] [-f PCT]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct light light;
+    struct report report;
+    struct display_frame expected;
+    unsigned long mismatches = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:o:f:")) != -1) {
+        switch (opt) {
+        case 'n':
+            report_count = atoi(optarg);
+            break;
+        case 'c':
+            change = atof(optarg) / 100;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'f':
+            failures = atof(optarg) / 100;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || report_count == 0) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    /* Power-up garbage, which the first update must cover. */
+    for (unsigned int p = 0; p < DISPLAY_PAGES; p++) {
+        for (unsigned int x = 0; x < DISPLAY_WIDTH; x++) {
+            panel.page[p][x] = uniform() * 256;
+        }
+    }
+
+    display_init(&recorder);
+    invent(&light);
+    for (unsigned int n = 0; n < report_count; n++) {
+        if (n > 0 && uniform() < change) {
+            invent(&light);
+        }
+        measure(&light, &report);
+        display_show(&report);
+
+        display_render(&report, &expected);
+        if (recovering > 0) {
+            recovering--;
+        } else if (memcmp(&expected, &panel, sizeof panel) != 0) {
+            fprintf(stderr, "report %u: panel doesn't match\n", n);
+            mismatches++;
+        }
+        if (prefix) {
+            save(n);
+        }
+    }
+
+    unsigned long full = DISPLAY_PAGES * (PAGE_OVERHEAD + DISPLAY_WIDTH);
+    fprintf(stderr, "%u reports, %lu updates, %.1f pages each, "
+            "%.0f bytes each (%.0f%% of a full refresh), %lu lost, "
+            "%lu mismatches\n",
+            report_count, updates, (double) pages_sent / updates,
+            (double) bytes_sent / updates,
+            100.0 * bytes_sent / (updates * full), lost, mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+/* Re-run the firmware's analysis over a pile of recorded captures,
+ * using the same dsp.c and fft.c, so that a change to the signal
+ * processing can be checked against thousands of real lamps before
+ * it goes anywhere near a meter.
+ *
+ * A capture file is a 16-byte header followed by the raw samples:
+ *   bytes 0-3    "FLK1"
+ *   bytes 4-7    sample rate, Hz
+ *   bytes 8-11   sample count
+ *   bytes 12-15  zero
+ *   then count 12-bit ADC samples, each a uint16_t with the error
+ *   flag in bit 15, exactly as the meter's samples[] holds them.
+ * Everything is little-endian.
+ *
+ * Each file is analysed the way measure() does it with the default
+ * settings: repair of bad samples, window, FFT up to a quarter of
+ * the sample rate, peak, a Goertzel zoom on the fundamental, then the
+ * flicker percentage from the averaged cycle.  The FFT takes the
+ * first power of two samples, up to the firmware's 16k; the rest
+ * count for the zoom and the averaging, as they do for long 8-bit
+ * captures on the meter.
+ *
+ * Files are memory-mapped, and handed out one at a time to a pool of
+ * worker threads, so a slow file doesn't hold the others up.  Results
+ * come out as CSV, one line per file, in the order given.
+ *
+ * Usage: flicker-batch [options] FILE...
+ *   -j THREADS  worker threads (default: one per CPU)
+ *   -o FILE     write the CSV to FILE (default: stdout)
+ *   -l HZ       ignore frequencies above HZ (default: rate / 4)
+ *   -k KERNELS  use these kernels: scalar, sse2 or avx2 (default: the
+ *               fastest this CPU has; see kernels.h)
+ *   -e PPM      bad samples per million to repair (default 1000, as
+ *               the meter's 'errors' setting)
+ *   -q          don't print the summary on stderr
+ *
+ * Files that can't be analysed get an error in the last column
+ * instead of results, and don't stop the others. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "fft.h"
+#include "kernels.h"
+#include "sample.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Capture files are little-endian, and so must we be."
+#endif
+
+/* Same limits as the firmware. */
+#define MAX_FFT_LENGTH (16u * 1024u)
+#define MIN_FFT_LENGTH 256u
+
+#define MAGIC "FLK1"
+
+struct header {
+    char magic[4];
+    uint32_t rate;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/* What we found in one file. */
+struct result {
+    const char *error;      /* NULL if it worked... */
+    int error_number;       /* ...or an errno, if that's what went wrong. */
+    uint32_t rate, count;
+    unsigned int errors;    /* Bad samples, repaired or not. */
+    unsigned int fft_length;
+    float fft_frequency;    /* Hz, to the nearest bucket or so. */
+    float magnitude;
+    float frequency;        /* Hz, zoomed in. */
+    unsigned int cycles;    /* Averaged, 0 if less than one. */
+    int flicker;            /* Percent. */
+};
+
+/* Each worker's buffers. */
+struct worker {
+    pthread_t thread;
+    float real[MAX_FFT_LENGTH];
+    float imag[MAX_FFT_LENGTH];
+    struct cycle cycle;
+};
+
+static char **paths;
+static struct result *results;
+static unsigned int file_count;
+static atomic_uint next_file;
+static float limit_hz;
+static unsigned int max_errors = 1000;
+static const struct kernels *kernels;
+
+/* Which file this thread is on, for assertion failures. */
+static _Thread_local const char *current;
+
+/* The firmware's ASSERT()s end up here: something's badly wrong
+ * with the analysis, so stop. */
+void assertion_failure(const char *pred, const char *file, int line)
+{
+    fprintf(stderr, "flicker-batch: %s: assertion failed at %s line %d: %s\n",
+            current ? current : "-", file, line, pred);
+    exit(2);
+}
+
+/* Largest power of two no more than @n. */
+static unsigned int floor_pow2(unsigned int n)
+{
+    unsigned int p = 1;
+    while (p <= n / 2) {
+        p *= 2;
+    }
+    return p;
+}
+
+/* Analyse @count samples at @rate Hz, as measure() would. */
+static void analyse(struct worker *w,
+                    uint16_t *samples,
+                    struct result *r)
+{
+    unsigned int count = r->count;
+    unsigned int n = floor_pow2(count < MAX_FFT_LENGTH ?
+                                count : MAX_FFT_LENGTH);
+    float hz_per_bucket = (float) r->rate / n;
+    float limit_f = (limit_hz > 0 ? limit_hz : r->rate / 4.0f) /
+                    hz_per_bucket + 0.5f;
+    unsigned int limit = limit_f;
+    struct zoom z;
+
+    if (n < MIN_FFT_LENGTH) {
+        r->error = "too short";
+        return;
+    }
+    r->fft_length = n;
+
+    /* Fill in the odd bad sample, and give up if there are too
+     * many, as the meter does. */
+    r->errors = repair(samples, count, NULL);
+    if ((uint64_t) r->errors * 1000000u > (uint64_t) max_errors * count) {
+        r->error = "sampling errors";
+        return;
+    }
+
+    /* peak() needs three buckets to interpolate. */
+    if (limit < 3) {
+        limit = 3;
+    }
+    if (limit > n / 2 + 1) {
+        limit = n / 2 + 1;
+    }
+
+    if (!kernels->window(samples, w->real, w->imag, n)) {
+        r->error = "sampling errors in a row";
+        return;
+    }
+    kernels->fft_pruned(w->real, w->imag, n, limit);
+    kernels->make_polar(w->real, w->imag, w->real, w->imag, limit);
+    float bucket = peak(w->real, limit);
+    unsigned int nearest = bucket + 0.5f;
+    r->fft_frequency = bucket * hz_per_bucket;
+    r->magnitude = w->real[nearest < limit ? nearest : limit - 1];
+
+    /* Zoom in on the fundamental, using every sample. */
+    float zoom_scale = (float) count / n;
+    r->frequency = r->fft_frequency;
+    if (bucket < limit) {
+        z.bucket = bucket * zoom_scale;
+        zoom(samples, count, &z, 1);
+        r->frequency = z.bucket / zoom_scale * hz_per_bucket;
+    }
+
+    float period = r->rate / r->frequency;
+    if (fold_cycles(samples, count, period, &w->cycle)) {
+        r->cycles = w->cycle.cycles;
+        r->flicker = mod_percent(w->cycle.mean, FOLD_BINS);
+    } else {
+        r->cycles = 0;
+        r->flicker = mod_percent(samples, count);
+    }
+}
+
+/* Map one capture file and analyse it. */
+static void process(struct worker *w, const char *path, struct result *r)
+{
+    struct stat st;
+    const struct header *h;
+    void *map;
+    int fd;
+
+    current = path;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        r->error_number = errno;
+        return;
+    }
+    if (fstat(fd, &st) < 0) {
+        r->error_number = errno;
+        close(fd);
+        return;
+    }
+    if ((size_t) st.st_size < sizeof *h) {
+        r->error = "not a capture";
+        close(fd);
+        return;
+    }
+    /* Private and writable, so repairs don't touch the file. */
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        r->error_number = errno;
+        close(fd);
+        return;
+    }
+    close(fd);
+    /* We'll read all of it, several times over. */
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    h = map;
+    r->rate = h->rate;
+    r->count = h->count;
+    if (memcmp(h->magic, MAGIC, sizeof h->magic) != 0) {
+        r->error = "not a capture";
+    } else if (h->rate == 0) {
+        r->error = "no sample rate";
+    } else if ((st.st_size - sizeof *h) / sizeof (uint16_t) < h->count) {
+        r->error = "truncated";
+    } else {
+        analyse(w, (uint16_t *)(h + 1), r);
+    }
+    munmap(map, st.st_size);
+}
+
+/* Worker: take files off the list until there are none left. */
+static void *work(void *arg)
+{
+    struct worker *w = arg;
+    unsigned int i;
+
+    while ((i = atomic_fetch_add(&next_file, 1)) < file_count) {
+        process(w, paths[i], &results[i]);
+    }
+    return NULL;
+}
+
+/* Write @s as a CSV field. */
+static void csv_string(FILE *f, const char *s)
+{
+    if (!strpbrk(s, ",\"\n")) {
+        fputs(s, f);
+        return;
+    }
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"') {
+            fputc('"', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: flicker-batch [-j THREADS] [-o FILE] [-l HZ] [-k KERNELS] "
+            "[-e PPM] [-q] FILE...\n");
+    exit(2);
+}
+
+/* @arg as a number from @min to @max, or the usage message if it
+ * isn't one. */
+static unsigned long number(const char *arg, unsigned long min,
+                            unsigned long max)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(arg, &end, 0);
+    if (!isdigit((unsigned char) *arg) || *end || errno ||
+        n < min || n > max) {
+        usage();
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    const char *kernel_name = NULL;
+    bool quiet = false;
+    struct worker *workers;
+    struct timespec start, end;
+    FILE *out = stdout;
+    unsigned int failures = 0;
+    uint64_t samples = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:o:l:k:e:q")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = number(optarg, 1, 4096);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            limit_hz = atof(optarg);
+            break;
+        case 'k':
+            kernel_name = optarg;
+            break;
+        case 'e':
+            max_errors = number(optarg, 0, 1000000);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind == argc || threads < 1) {
+        usage();
+    }
+    kernels = kernels_select(kernel_name);
+    if (!kernels) {
+        fprintf(stderr, "flicker-batch: no %s kernels on this CPU\n",
+                kernel_name);
+        return 2;
+    }
+    paths = argv + optind;
+    file_count = argc - optind;
+    if (threads > file_count) {
+        threads = file_count;
+    }
+
+    results = calloc(file_count, sizeof *results);
+    workers = calloc(threads, sizeof *workers);
+    if (!results || !workers) {
+        perror("flicker-batch");
+        return 2;
+    }
+    if (output && !(out = fopen(output, "w"))) {
+        perror(output);
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long t = 0; t < threads; t++) {
+        int err = pthread_create(&workers[t].thread, NULL, work, &workers[t]);
+        if (err) {
+            fprintf(stderr, "flicker-batch: %s\n", strerror(err));
+            return 2;
+        }
+    }
+    for (long t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(out, "file,rate,count,errors,fft_length,fft_frequency,"
+            "magnitude,frequency,cycles,flicker,error\n");
+    for (unsigned int i = 0; i < file_count; i++) {
+        const struct result *r = &results[i];
+
+        csv_string(out, paths[i]);
+        if (r->error || r->error_number) {
+            fprintf(out, ",%u,%u,%u,,,,,,,", r->rate, r->count, r->errors);
+            /* strerror() isn't thread-safe, so the workers leave
+             * the errno for us. */
+            csv_string(out, r->error_number ? strerror(r->error_number) :
+                                              r->error);
+            fputc('\n', out);
+            failures++;
+            continue;
+        }
+        fprintf(out, ",%u,%u,%u,%u,%f,%f,%f,%u,%d,\n",
+                r->rate, r->count, r->errors, r->fft_length, r->fft_frequency,
+                r->magnitude, r->frequency, r->cycles, r->flicker);
+        samples += r->count;
+    }
+    if (fflush(out) != 0 || (output && fclose(out) != 0)) {
+        perror(output ? output : "stdout");
+        return 2;
+    }
+
+    if (!quiet) {
+        double seconds = (end.tv_sec - start.tv_sec) +
+                         (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%u files (%u failed), %.1fM samples, %ld threads, "
+                "%s kernels, %.2fs: %.0f files/s\n",
+                file_count, failures, samples / 1e6, threads,
+                kernels->name, seconds, file_count / seconds);
+    }
+    return 0;
+}
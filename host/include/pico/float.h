@@ -0,0 +1,11 @@
+#pragma once
+
+/* Stand-in for the Pico SDK's pico/float.h, so firmware sources that
+ * include it build on Linux: the C library already has the fast
+ * float functions, but not the SDK's extra constants. */
+
+#include <math.h>
+
+#ifndef M_TWOPI
+#define M_TWOPI (2 * M_PI)
+#endif
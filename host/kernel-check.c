@@ -0,0 +1,253 @@
+/* Check the host's vectorised kernels against the firmware's own,
+ * and time them.
+ *
+ * Every set of kernels this CPU can run gets the FFT test vectors from
+ * firmware/tests (full and pruned, with the same tolerance as the
+ * unit tests), and windows and magnitudes of made-up captures, which
+ * must match the firmware's scalar code closely.  Then each kernel is
+ * timed at the firmware's longest length.
+ *
+ * Usage: kernel-check [-n REPEATS]
+ *
+ * Exits with status 1 if anything doesn't match. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "fft.h"
+#include "kernels.h"
+#include "sample.h"
+
+#define MAX_LENGTH (16u * 1024u)
+
+static float real[MAX_LENGTH], imag[MAX_LENGTH];
+static float real2[MAX_LENGTH], imag2[MAX_LENGTH];
+static uint16_t samples[MAX_LENGTH];
+
+static const struct kernels *k;
+static bool failed;
+static unsigned int repeats = 200;
+
+/* The firmware's ASSERT()s end up here. */
+void assertion_failure(const char *pred, const char *file, int line)
+{
+    fprintf(stderr, "kernel-check: assertion failed at %s line %d: %s\n",
+            file, line, pred);
+    exit(2);
+}
+
+/* The unit tests' check that an FFT is close enough: any entry may be
+ * off by 0.001% of the largest, plus a bit for rounding. */
+static bool fft_match(const float *ours,
+                      const float *theirs,
+                      unsigned int length)
+{
+    unsigned int errors = 0;
+    float max = 0.0;
+
+    for (unsigned int i = 0; i < length; i++) {
+        max = fmaxf(max, theirs[i]);
+    }
+    float abs_margin = max / 100000;
+
+    for (unsigned int i = 0; i < length && errors < 10; i++) {
+        float a = ours[i], b = theirs[i];
+        float rel_margin = fabsf(a) + fabsf(b) / 1000;
+        if (fabsf(a - b) > abs_margin + rel_margin) {
+            printf("  %u: %f != %f\n", i, a, b);
+            errors++;
+        }
+    }
+    return errors == 0;
+}
+
+/* Check two arrays agree to within @tolerance of the largest entry. */
+static bool close_to(const float *ours,
+                     const float *theirs,
+                     unsigned int length,
+                     float tolerance)
+{
+    float max = 0;
+    unsigned int errors = 0;
+
+    for (unsigned int i = 0; i < length; i++) {
+        max = fmaxf(max, fabsf(theirs[i]));
+    }
+    for (unsigned int i = 0; i < length && errors < 10; i++) {
+        if (fabsf(ours[i] - theirs[i]) > tolerance * max) {
+            printf("  %u: %g != %g\n", i, ours[i], theirs[i]);
+            errors++;
+        }
+    }
+    return errors == 0;
+}
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("%s: %s FAILED\n", k->name, what);
+        failed = true;
+    }
+}
+
+/* Called by each of the fft-test-*.h files. */
+static void fft_test(const char *name,
+                     unsigned int length,
+                     const float *real_input,
+                     const float *real_reference,
+                     const float *imag_reference)
+{
+    char what[64];
+
+    memcpy(real, real_input, length * sizeof *real);
+    memset(imag, 0, length * sizeof *imag);
+    k->fft_pruned(real, imag, length, length);
+    snprintf(what, sizeof what, "FFT %s", name);
+    check(fft_match(real, real_reference, length) &&
+          fft_match(imag, imag_reference, length), what);
+
+    memcpy(real, real_input, length * sizeof *real);
+    memset(imag, 0, length * sizeof *imag);
+    k->fft_pruned(real, imag, length, length / 4);
+    snprintf(what, sizeof what, "pruned FFT %s", name);
+    check(fft_match(real, real_reference, length / 4) &&
+          fft_match(imag, imag_reference, length / 4), what);
+}
+
+/* A light at 100Hz-ish with some noise, in ADC units. */
+static void make_samples(unsigned int count)
+{
+    srand(41);
+    for (unsigned int i = 0; i < count; i++) {
+        samples[i] = 2000 + 1500 * sin(2 * M_PI * i / 2503.0)
+                   + 200 * sin(2 * M_PI * i / 97.0) + rand() % 16;
+    }
+}
+
+/* window() and make_polar() against the firmware's. */
+static void dsp_test(unsigned int count)
+{
+    char what[64];
+    bool ok;
+
+    make_samples(count);
+    window(samples, real2, imag2, count);
+    ok = k->window(samples, real, imag, count);
+    snprintf(what, sizeof what, "window %u", count);
+    check(ok && close_to(real, real2, count, 1e-5) &&
+          close_to(imag, imag2, count, 0), what);
+
+    /* Errors still get caught. */
+    samples[count / 3] |= SAMPLE_ERROR;
+    snprintf(what, sizeof what, "window %u error", count);
+    check(!k->window(samples, real, imag, count), what);
+
+    /* Magnitudes and phases of a real spectrum, in place. */
+    fft(real2, imag2, count);
+    memcpy(real, real2, count * sizeof *real);
+    memcpy(imag, imag2, count * sizeof *imag);
+    make_polar(real2, imag2, real2, imag2, count / 2 + 1);
+    k->make_polar(real, imag, real, imag, count / 2 + 1);
+    snprintf(what, sizeof what, "make_polar %u", count);
+    check(close_to(real, real2, count / 2 + 1, 1e-6) &&
+          close_to(imag, imag2, count / 2 + 1, 1e-6), what);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Time each kernel at the longest length, in microseconds a call. */
+static void timing(void)
+{
+    double start, fft_us, pruned_us, window_us, polar_us;
+
+    make_samples(MAX_LENGTH);
+
+    start = now();
+    for (unsigned int r = 0; r < repeats; r++) {
+        k->window(samples, real, imag, MAX_LENGTH);
+    }
+    window_us = (now() - start) / repeats * 1e6;
+
+    start = now();
+    for (unsigned int r = 0; r < repeats; r++) {
+        k->fft_pruned(real, imag, MAX_LENGTH, MAX_LENGTH);
+    }
+    fft_us = (now() - start) / repeats * 1e6;
+
+    start = now();
+    for (unsigned int r = 0; r < repeats; r++) {
+        k->fft_pruned(real, imag, MAX_LENGTH, MAX_LENGTH / 4);
+    }
+    pruned_us = (now() - start) / repeats * 1e6;
+
+    start = now();
+    for (unsigned int r = 0; r < repeats; r++) {
+        k->make_polar(real, imag, real2, imag2, MAX_LENGTH / 2 + 1);
+    }
+    polar_us = (now() - start) / repeats * 1e6;
+
+    printf("%-6s  window %7.1fus  fft %7.1fus  pruned %7.1fus  "
+           "make_polar %7.1fus\n",
+           k->name, window_us, fft_us, pruned_us, polar_us);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: kernel-check [-n REPEATS]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const struct kernels *const *all = kernels_available();
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            repeats = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || repeats == 0) {
+        usage();
+    }
+
+    for (unsigned int i = 0; all[i]; i++) {
+        k = all[i];
+
+#include "fft-test-cosine.h"
+#include "fft-test-noise.h"
+#include "fft-test-square.h"
+#include "fft-test-bigsquare.h"
+#include "fft-test-sawtooth.h"
+#include "fft-test-bigsawtooth.h"
+
+        dsp_test(4096);
+        dsp_test(MAX_LENGTH);
+    }
+
+    printf("Best here: %s.  Times for %u samples:\n",
+           kernels_select(NULL)->name, MAX_LENGTH);
+    for (unsigned int i = 0; all[i]; i++) {
+        k = all[i];
+        timing();
+    }
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
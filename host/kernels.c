@@ -0,0 +1,553 @@
+/* Vectorised versions of the firmware's FFT, window and magnitude
+ * loops, for the host tools.
+ *
+ * The FFT is the firmware's pruned radix-2 FFT with its loops turned
+ * inside out: for each group of butterflies, the steps run along
+ * contiguous memory, so a vector does 4 or 8 of them at once.  That
+ * needs every twiddle factor of a stage side by side, so they come
+ * from a table worked out once, in double precision, instead of one
+ * sincosf() per step.  The first two stages, whose twiddles are
+ * trivial, are done together without multiplies; the next few, with
+ * fewer butterflies per group than a vector holds, and the odd ones
+ * left over at the end of a group, are done one at a time.
+ *
+ * The window function is likewise worked out once per length and
+ * kept, which leaves window() just a multiply per sample; finding
+ * the mean and checking for error flags is one vectorised pass.
+ *
+ * Magnitudes are vectorised; the angles still go through
+ * fast_atan2f() one at a time.
+ *
+ * Each vector version is compiled for its own instruction set with
+ * target attributes, so the binary runs anywhere and we pick one by
+ * asking the CPU what it has.  The scalar fallback is the firmware's
+ * own code. */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "fastmath.h"
+#include "fft.h"
+#include "kernels.h"
+#include "sample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Longest FFT we have twiddle factors for; longer ones, which the
+ * firmware never does, go to the scalar code. */
+#define MAX_LENGTH (64u * 1024u)
+
+/* Window lengths we keep tables for.  Host tools use a handful. */
+#define WINDOW_CACHE 16u
+
+/* Twiddle factors e^(-2.pi.i.step/sub_length), for each stage in
+ * turn: the stage with half = sub_length/2 has its 'half' factors
+ * starting at index half - 1. */
+static float twiddle_cos[MAX_LENGTH - 1];
+static float twiddle_sin[MAX_LENGTH - 1];
+static pthread_once_t twiddle_once = PTHREAD_ONCE_INIT;
+
+static void make_twiddles(void)
+{
+    for (unsigned int half = 1; half < MAX_LENGTH; half *= 2) {
+        for (unsigned int step = 0; step < half; step++) {
+            double angle = -M_PI * step / half;
+            twiddle_cos[half - 1 + step] = cos(angle);
+            twiddle_sin[half - 1 + step] = sin(angle);
+        }
+    }
+}
+
+/* Window functions we've worked out, by length. */
+static struct {
+    unsigned int count;
+    float *window;
+} windows[WINDOW_CACHE];
+static pthread_mutex_t windows_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The window() function for @count samples, or NULL if we
+ * can't keep any more. */
+static const float *window_table(unsigned int count)
+{
+    float *table = NULL;
+
+    pthread_mutex_lock(&windows_lock);
+    for (unsigned int i = 0; i < WINDOW_CACHE; i++) {
+        if (windows[i].count == count) {
+            table = windows[i].window;
+            break;
+        }
+        if (windows[i].count == 0) {
+            /* Same Gaussian, r = 8, as window(). */
+            table = malloc(count * sizeof *table);
+            if (!table) {
+                break;
+            }
+            double K = -32.0 / ((double) count * count);
+            double middle = (count - 1) / 2.0;
+            for (unsigned int j = 0; j < count; j++) {
+                double t = j - middle;
+                table[j] = exp(K * t * t);
+            }
+            windows[i].count = count;
+            windows[i].window = table;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&windows_lock);
+    return table;
+}
+
+/* Bit-reverse shuffle two arrays of @count entries in place, as fft.c
+ * does, counting j up in reversed binary rather than reversing each
+ * index bit by bit. */
+static void bit_reverse_shuffle(float *real, float *imag, unsigned int count)
+{
+    unsigned int j = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (i < j) {
+            float t = real[i];
+            real[i] = real[j];
+            real[j] = t;
+            t = imag[i];
+            imag[i] = imag[j];
+            imag[j] = t;
+        }
+        unsigned int bit = count >> 1;
+        while (bit && (j & bit)) {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j |= bit;
+    }
+}
+
+/* One stage's worth of butterflies for one group, steps @from to @to:
+ * A' = A + TB and B' = A - TB, with twiddles @wc, @ws. */
+static void butterflies(float *ar, float *ai, float *br, float *bi,
+                        const float *wc, const float *ws,
+                        unsigned int from, unsigned int to)
+{
+    for (unsigned int k = from; k < to; k++) {
+        float tr = br[k] * wc[k] - bi[k] * ws[k];
+        float ti = bi[k] * wc[k] + br[k] * ws[k];
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] += tr;
+        ai[k] += ti;
+    }
+}
+
+/* The same where only A' is wanted. */
+static void a_only(float *ar, float *ai, const float *br, const float *bi,
+                   const float *wc, const float *ws,
+                   unsigned int from, unsigned int to)
+{
+    for (unsigned int k = from; k < to; k++) {
+        ar[k] += br[k] * wc[k] - bi[k] * ws[k];
+        ai[k] += bi[k] * wc[k] + br[k] * ws[k];
+    }
+}
+
+/* The pruning bounds for the stage with groups of 2 * @half:
+ * steps below @both need the whole butterfly, and from there
+ * to @steps only the A half.  See fft_pruned() in fft.c. */
+static void stage_bounds(unsigned int half, unsigned int max_bin,
+                         unsigned int *both, unsigned int *steps)
+{
+    unsigned int wanted = (max_bin < 2 * half) ? max_bin : 2 * half;
+    *steps = (wanted < half) ? wanted : half;
+    *both = (wanted > half) ? wanted - half : 0;
+}
+
+/* The first two stages, whose twiddles are 1 and -i, as one pass
+ * over groups of 4 with no multiplies: short groups are where the
+ * vectors can't help, and these two have the most of them.  Returns
+ * the half the vector stages start at. */
+static unsigned int first_stages(float *real, float *imag,
+                                 unsigned int length, unsigned int max_bin)
+{
+    /* Pruning only starts to bite at these stages below 4 bins. */
+    if (length < 4 || max_bin < 4) {
+        return 1;
+    }
+    for (unsigned int i = 0; i < length; i += 4) {
+        float *r = real + i, *m = imag + i;
+        float r0 = r[0] + r[1], i0 = m[0] + m[1];
+        float r1 = r[0] - r[1], i1 = m[0] - m[1];
+        float r2 = r[2] + r[3], i2 = m[2] + m[3];
+        float r3 = r[2] - r[3], i3 = m[2] - m[3];
+        r[0] = r0 + r2;
+        m[0] = i0 + i2;
+        r[2] = r0 - r2;
+        m[2] = i0 - i2;
+        /* (r3 + i.i3) * -i = i3 - i.r3 */
+        r[1] = r1 + i3;
+        m[1] = i1 - r3;
+        r[3] = r1 - i3;
+        m[3] = i1 + r3;
+    }
+    return 4;
+}
+
+/* Check the arguments as fft_pruned() does, and shuffle.  Returns
+ * false if the vector code can't do this length. */
+static bool fft_start(float *real, float *imag, unsigned int length,
+                      unsigned int max_bin)
+{
+    if (length == 0 || (length & (length - 1)) != 0 ||
+        length > MAX_LENGTH || max_bin == 0 || max_bin > length) {
+        return false;
+    }
+    pthread_once(&twiddle_once, make_twiddles);
+    bit_reverse_shuffle(real, imag, length);
+    return true;
+}
+
+#ifdef HAVE_X86
+
+/* Find the sum of @count samples, and whether any has its error
+ * flag set, 8 at a time. */
+__attribute__((target("sse2")))
+static bool sum_sse2(const uint16_t *samples, unsigned int count,
+                     uint64_t *total)
+{
+    __m128i zero = _mm_setzero_si128(), flags = zero;
+    unsigned int i = 0;
+    uint64_t rest = 0;
+    uint16_t any = 0;
+
+    /* Each 32-bit lane sum takes two samples a block, so it can only
+     * take 2^15 blocks of the largest before it might overflow. */
+    while (i + 8 <= count) {
+        unsigned int end = i + 8 * 32768u;
+        __m128i part = zero;
+        for (; i + 8 <= count && i < end; i += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+            flags = _mm_or_si128(flags, s);
+            part = _mm_add_epi32(part, _mm_unpacklo_epi16(s, zero));
+            part = _mm_add_epi32(part, _mm_unpackhi_epi16(s, zero));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *) lanes, part);
+        rest += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    uint16_t f[8];
+    _mm_storeu_si128((__m128i *) f, flags);
+    for (unsigned int j = 0; j < 8; j++) {
+        any |= f[j];
+    }
+    for (; i < count; i++) {
+        rest += samples[i];
+        any |= samples[i];
+    }
+    *total = rest;
+    return !(any & SAMPLE_ERROR);
+}
+
+__attribute__((target("sse2")))
+static void fft_sse2(float *real, float *imag, unsigned int length,
+                     unsigned int max_bin)
+{
+    if (!fft_start(real, imag, length, max_bin)) {
+        fft_pruned(real, imag, length, max_bin);
+        return;
+    }
+
+    for (unsigned int half = first_stages(real, imag, length, max_bin);
+         half < length; half *= 2) {
+        const float *wc = twiddle_cos + half - 1;
+        const float *ws = twiddle_sin + half - 1;
+        unsigned int both, steps;
+        stage_bounds(half, max_bin, &both, &steps);
+
+        for (unsigned int base = 0; base < length; base += 2 * half) {
+            float *ar = real + base, *ai = imag + base;
+            float *br = ar + half, *bi = ai + half;
+            unsigned int k = 0;
+
+            for (; k + 4 <= both; k += 4) {
+                __m128 c = _mm_loadu_ps(wc + k), s = _mm_loadu_ps(ws + k);
+                __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+                __m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, c), _mm_mul_ps(xi, s));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xi, c), _mm_mul_ps(xr, s));
+                _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+                _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+            }
+            butterflies(ar, ai, br, bi, wc, ws, k, both);
+
+            for (k = both; k + 4 <= steps; k += 4) {
+                __m128 c = _mm_loadu_ps(wc + k), s = _mm_loadu_ps(ws + k);
+                __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, c), _mm_mul_ps(xi, s));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xi, c), _mm_mul_ps(xr, s));
+                _mm_storeu_ps(ar + k, _mm_add_ps(_mm_loadu_ps(ar + k), tr));
+                _mm_storeu_ps(ai + k, _mm_add_ps(_mm_loadu_ps(ai + k), ti));
+            }
+            a_only(ar, ai, br, bi, wc, ws, k, steps);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static bool window_sse2(const uint16_t *samples, float *real, float *imag,
+                        unsigned int count)
+{
+    const float *table = window_table(count);
+    uint64_t total;
+    unsigned int i = 0;
+
+    /* Let the firmware's code report the error. */
+    if (!table || !sum_sse2(samples, count, &total)) {
+        return window(samples, real, imag, count);
+    }
+
+    float mean = (float) total / count;
+    __m128i zero = _mm_setzero_si128();
+    __m128 m = _mm_set1_ps(mean), z = _mm_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero));
+        _mm_storeu_ps(real + i,
+                      _mm_mul_ps(_mm_loadu_ps(table + i), _mm_sub_ps(lo, m)));
+        _mm_storeu_ps(real + i + 4,
+                      _mm_mul_ps(_mm_loadu_ps(table + i + 4), _mm_sub_ps(hi, m)));
+        _mm_storeu_ps(imag + i, z);
+        _mm_storeu_ps(imag + i + 4, z);
+    }
+    for (; i < count; i++) {
+        real[i] = table[i] * ((float) samples[i] - mean);
+        imag[i] = 0;
+    }
+    return true;
+}
+
+__attribute__((target("sse2")))
+static void make_polar_sse2(const float *real, const float *imag,
+                            float *abs, float *angle, unsigned int count)
+{
+    unsigned int n = 0;
+
+    /* @abs and @angle may be @real and @imag, so read
+     * each block before writing it. */
+    for (; n + 4 <= count; n += 4) {
+        float r[4], i[4];
+        __m128 vr = _mm_loadu_ps(real + n), vi = _mm_loadu_ps(imag + n);
+        _mm_storeu_ps(r, vr);
+        _mm_storeu_ps(i, vi);
+        _mm_storeu_ps(abs + n, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vr, vr),
+                                                      _mm_mul_ps(vi, vi))));
+        for (unsigned int j = 0; j < 4; j++) {
+            angle[n + j] = fast_atan2f(i[j], r[j]);
+        }
+    }
+    make_polar(real + n, imag + n, abs + n, angle + n, count - n);
+}
+
+__attribute__((target("avx2")))
+static bool sum_avx2(const uint16_t *samples, unsigned int count,
+                     uint64_t *total)
+{
+    __m256i zero = _mm256_setzero_si256(), flags = zero;
+    unsigned int i = 0;
+    uint64_t rest = 0;
+    uint16_t any = 0;
+
+    while (i + 16 <= count) {
+        unsigned int end = i + 16 * 32768u;
+        __m256i part = zero;
+        for (; i + 16 <= count && i < end; i += 16) {
+            __m256i s = _mm256_loadu_si256((const __m256i *)(samples + i));
+            flags = _mm256_or_si256(flags, s);
+            part = _mm256_add_epi32(part, _mm256_unpacklo_epi16(s, zero));
+            part = _mm256_add_epi32(part, _mm256_unpackhi_epi16(s, zero));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *) lanes, part);
+        for (unsigned int j = 0; j < 8; j++) {
+            rest += lanes[j];
+        }
+    }
+    uint16_t f[16];
+    _mm256_storeu_si256((__m256i *) f, flags);
+    for (unsigned int j = 0; j < 16; j++) {
+        any |= f[j];
+    }
+    for (; i < count; i++) {
+        rest += samples[i];
+        any |= samples[i];
+    }
+    *total = rest;
+    return !(any & SAMPLE_ERROR);
+}
+
+__attribute__((target("avx2,fma")))
+static void fft_avx2(float *real, float *imag, unsigned int length,
+                     unsigned int max_bin)
+{
+    if (!fft_start(real, imag, length, max_bin)) {
+        fft_pruned(real, imag, length, max_bin);
+        return;
+    }
+
+    for (unsigned int half = first_stages(real, imag, length, max_bin);
+         half < length; half *= 2) {
+        const float *wc = twiddle_cos + half - 1;
+        const float *ws = twiddle_sin + half - 1;
+        unsigned int both, steps;
+        stage_bounds(half, max_bin, &both, &steps);
+
+        for (unsigned int base = 0; base < length; base += 2 * half) {
+            float *ar = real + base, *ai = imag + base;
+            float *br = ar + half, *bi = ai + half;
+            unsigned int k = 0;
+
+            for (; k + 8 <= both; k += 8) {
+                __m256 c = _mm256_loadu_ps(wc + k), s = _mm256_loadu_ps(ws + k);
+                __m256 xr = _mm256_loadu_ps(br + k), xi = _mm256_loadu_ps(bi + k);
+                __m256 yr = _mm256_loadu_ps(ar + k), yi = _mm256_loadu_ps(ai + k);
+                __m256 tr = _mm256_fmsub_ps(xr, c, _mm256_mul_ps(xi, s));
+                __m256 ti = _mm256_fmadd_ps(xi, c, _mm256_mul_ps(xr, s));
+                _mm256_storeu_ps(ar + k, _mm256_add_ps(yr, tr));
+                _mm256_storeu_ps(ai + k, _mm256_add_ps(yi, ti));
+                _mm256_storeu_ps(br + k, _mm256_sub_ps(yr, tr));
+                _mm256_storeu_ps(bi + k, _mm256_sub_ps(yi, ti));
+            }
+            butterflies(ar, ai, br, bi, wc, ws, k, both);
+
+            for (k = both; k + 8 <= steps; k += 8) {
+                __m256 c = _mm256_loadu_ps(wc + k), s = _mm256_loadu_ps(ws + k);
+                __m256 xr = _mm256_loadu_ps(br + k), xi = _mm256_loadu_ps(bi + k);
+                __m256 tr = _mm256_fmsub_ps(xr, c, _mm256_mul_ps(xi, s));
+                __m256 ti = _mm256_fmadd_ps(xi, c, _mm256_mul_ps(xr, s));
+                _mm256_storeu_ps(ar + k, _mm256_add_ps(_mm256_loadu_ps(ar + k), tr));
+                _mm256_storeu_ps(ai + k, _mm256_add_ps(_mm256_loadu_ps(ai + k), ti));
+            }
+            a_only(ar, ai, br, bi, wc, ws, k, steps);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static bool window_avx2(const uint16_t *samples, float *real, float *imag,
+                        unsigned int count)
+{
+    const float *table = window_table(count);
+    uint64_t total;
+    unsigned int i = 0;
+
+    if (!table || !sum_avx2(samples, count, &total)) {
+        return window(samples, real, imag, count);
+    }
+
+    float mean = (float) total / count;
+    __m256 m = _mm256_set1_ps(mean), z = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(s));
+        _mm256_storeu_ps(real + i, _mm256_mul_ps(_mm256_loadu_ps(table + i),
+                                                 _mm256_sub_ps(x, m)));
+        _mm256_storeu_ps(imag + i, z);
+    }
+    for (; i < count; i++) {
+        real[i] = table[i] * ((float) samples[i] - mean);
+        imag[i] = 0;
+    }
+    return true;
+}
+
+__attribute__((target("avx2,fma")))
+static void make_polar_avx2(const float *real, const float *imag,
+                            float *abs, float *angle, unsigned int count)
+{
+    unsigned int n = 0;
+
+    for (; n + 8 <= count; n += 8) {
+        float r[8], i[8];
+        __m256 vr = _mm256_loadu_ps(real + n), vi = _mm256_loadu_ps(imag + n);
+        _mm256_storeu_ps(r, vr);
+        _mm256_storeu_ps(i, vi);
+        _mm256_storeu_ps(abs + n, _mm256_sqrt_ps(
+            _mm256_fmadd_ps(vr, vr, _mm256_mul_ps(vi, vi))));
+        for (unsigned int j = 0; j < 8; j++) {
+            angle[n + j] = fast_atan2f(i[j], r[j]);
+        }
+    }
+    make_polar(real + n, imag + n, abs + n, angle + n, count - n);
+}
+
+static const struct kernels sse2 = {
+    .name = "sse2",
+    .fft_pruned = fft_sse2,
+    .window = window_sse2,
+    .make_polar = make_polar_sse2,
+};
+
+static const struct kernels avx2 = {
+    .name = "avx2",
+    .fft_pruned = fft_avx2,
+    .window = window_avx2,
+    .make_polar = make_polar_avx2,
+};
+
+#endif /* HAVE_X86 */
+
+static const struct kernels scalar = {
+    .name = "scalar",
+    .fft_pruned = fft_pruned,
+    .window = window,
+    .make_polar = make_polar,
+};
+
+/* All the kernels this CPU can run, slowest first. */
+static const struct kernels *available[4];
+static pthread_once_t available_once = PTHREAD_ONCE_INIT;
+
+static void find_available(void)
+{
+    unsigned int n = 0;
+
+    available[n++] = &scalar;
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        available[n++] = &sse2;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        available[n++] = &avx2;
+    }
+#endif
+    available[n] = NULL;
+}
+
+const struct kernels *const *kernels_available(void)
+{
+    pthread_once(&available_once, find_available);
+    return available;
+}
+
+/* The kernels called @name, or the best we have. */
+const struct kernels *kernels_select(const char *name)
+{
+    const struct kernels *const *k = kernels_available();
+    const struct kernels *best = NULL;
+
+    for (; *k; k++) {
+        if (!name || strcmp((*k)->name, name) == 0) {
+            best = *k;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The firmware's hot loops for the host tools: either the firmware's
+ * own code, or versions vectorised for the CPU we're running on.
+ * They give the same answers as the firmware to within its FFT test
+ * tolerance (kernel-check checks), and can be used anywhere the
+ * functions of the same names in fft.h and dsp.h would be. */
+struct kernels {
+    const char *name;
+    void (*fft_pruned)(float *real, float *imag, unsigned int length,
+                       unsigned int max_bin);
+    bool (*window)(const uint16_t *samples, float *real, float *imag,
+                   unsigned int count);
+    void (*make_polar)(const float *real, const float *imag,
+                       float *abs, float *angle, unsigned int count);
+};
+
+/* The kernels called @name ("scalar", "sse2" or "avx2"), or the best
+ * this CPU can run if @name is NULL.  Returns NULL if there are none
+ * by that name or the CPU can't run them. */
+extern const struct kernels *kernels_select(const char *name);
+
+/* All the kernels this CPU can run, slowest first, ending with NULL. */
+extern const struct kernels *const *kernels_available(void);
@@ -0,0 +1,293 @@
+/* Pretend to be a fleet of flicker meters, for load-testing the
+ * collector without a drawer full of hardware.
+ *
+ * Each emulated meter is a pseudo-terminal that prints the same
+ * report the firmware does (AGC line, two 80x20 ASCII graphs and the
+ * frequency and flicker numbers), for a made-up light source, every
+ * couple of seconds.  Like the real USB console, a meter whose output
+ * isn't being read just drops it rather than blocking.
+ *
+ * Usage: meter-emulator [options]
+ *   -n COUNT  number of meters (default 1)
+ *   -i MS     measurement interval in milliseconds (default 2000)
+ *   -d DIR    also make symlinks DIR/meter0, DIR/meter1, ...
+ *   -e PCT    percentage of measurements with sampling errors; a quarter
+ *             of those have too many to repair, and fail
+ *
+ * The terminal device names are printed on stdout, one per line,
+ * so they can be fed straight to flicker-collector. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Same graph size as the firmware. */
+#define WIDTH 80u
+#define HEIGHT 20u
+
+/* How often we look for meters that are due. */
+#define TICK_MS 5
+
+struct meter {
+    int master, slave;
+    char name[64];
+
+    /* The light this meter is pointed at. */
+    double frequency;
+    double flicker;
+    unsigned int agc;
+
+    /* When the next report is due, in ms since start. */
+    uint64_t due;
+
+    /* Statistics. */
+    unsigned long reports, dropped;
+};
+
+static struct meter *meters;
+static unsigned int meter_count = 1;
+static unsigned int interval_ms = 2000;
+static unsigned int error_percent;
+static volatile sig_atomic_t stop;
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+/* Milliseconds since an arbitrary start point. */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Uniform random number in [lo, hi). */
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * (random() / ((double) RAND_MAX + 1));
+}
+
+/* Pick a plausible light source for a meter. */
+static void meter_choose_light(struct meter *m)
+{
+    static const double common[] = { 100.0, 120.0, 240.0, 1000.0, 25000.0 };
+    m->frequency = common[random() % 5] * uniform(0.995, 1.005);
+    m->flicker = uniform(1, 80);
+    m->agc = random() % 128;
+}
+
+/* Create a pseudo-terminal for a meter, in raw mode. */
+static void meter_open(struct meter *m, unsigned int index, const char *dir)
+{
+    struct termios tio;
+
+    m->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m->master < 0 || grantpt(m->master) < 0 || unlockpt(m->master) < 0) {
+        die("posix_openpt");
+    }
+    snprintf(m->name, sizeof m->name, "%s", ptsname(m->master));
+
+    /* Hold the far end open ourselves, so that output buffers up
+     * (and eventually drops) while nobody is listening, instead
+     * of the terminal hanging up. */
+    m->slave = open(m->name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (m->slave < 0) {
+        die(m->name);
+    }
+    if (tcgetattr(m->slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(m->slave, TCSANOW, &tio);
+    }
+
+    if (dir) {
+        char link[4096];
+        snprintf(link, sizeof link, "%s/meter%u", dir, index);
+        unlink(link);
+        if (symlink(m->name, link) < 0) {
+            die(link);
+        }
+    }
+
+    meter_choose_light(m);
+    m->due = now_ms() + random() % interval_ms;
+}
+
+/* Append one 80x20 frame, drawn from @y (in [0, 1]) per column. */
+static size_t put_frame(char *buf, const double *y)
+{
+    size_t n = 0;
+    memset(buf + n, '-', WIDTH);
+    n += WIDTH;
+    buf[n++] = '\n';
+    for (unsigned int row = 0; row < HEIGHT; row++) {
+        double level = (HEIGHT - 1 - row) / (double) (HEIGHT - 1);
+        for (unsigned int x = 0; x < WIDTH; x++) {
+            bool on = fabs(y[x] - level) < 0.5 / (HEIGHT - 1);
+            buf[n++] = on ? '*' : ' ';
+        }
+        buf[n++] = '\n';
+    }
+    memset(buf + n, '-', WIDTH);
+    n += WIDTH;
+    buf[n++] = '\n';
+    return n;
+}
+
+/* Format one complete report for a meter. */
+static size_t meter_report(struct meter *m, char *buf, size_t size)
+{
+    double y[WIDTH];
+    size_t n;
+
+    /* Let the light wander a little between measurements. */
+    m->frequency *= uniform(0.9999, 1.0001);
+    m->flicker = fmin(100, fmax(0, m->flicker + uniform(-0.5, 0.5)));
+
+    n = snprintf(buf, size, "AGC: %u/127%s\n", m->agc,
+                 m->agc == 0 ? " (TOO BRIGHT)" :
+                 m->agc == 127 ? " (TOO DARK)" : "");
+
+    if (error_percent && (unsigned int) (random() % 100) < error_percent) {
+        if (random() % 4 == 0) {
+            n += snprintf(buf + n, size - n,
+                          "Sampling errors: %ld of 16384 samples bad.\n",
+                          17 + random() % 100);
+            return n;
+        }
+        n += snprintf(buf + n, size - n, "Repaired %ld bad samples.\n",
+                      1 + random() % 16);
+    }
+
+    /* Spectrum: a bump at the flicker frequency on a log-x scale. */
+    double peak_x = log2(m->frequency / 15.2587890625) / 13 * (WIDTH - 1);
+    for (unsigned int x = 0; x < WIDTH; x++) {
+        double d = (x - peak_x) / 2;
+        y[x] = exp(-d * d) + uniform(0, 0.05);
+    }
+    n += put_frame(buf + n, y);
+    n += snprintf(buf + n, size - n,
+                  "FFT: peak at %fHz\nFFT: peak magnitude %f\n",
+                  m->frequency, uniform(1e4, 5e5));
+    n += snprintf(buf + n, size - n,
+                  "Harmonics: THD %.1f%%, dB -%.0f -%.0f -%.0f\n",
+                  uniform(1, 40), uniform(6, 20), uniform(20, 40),
+                  uniform(30, 60));
+
+    /* Waveform: two cycles. */
+    double depth = m->flicker / 100;
+    for (unsigned int x = 0; x < WIDTH; x++) {
+        double s = sin(2 * M_PI * 2 * x / WIDTH);
+        y[x] = (1 + depth * s) / (1 + depth);
+    }
+    n += put_frame(buf + n, y);
+    n += snprintf(buf + n, size - n, "Raw samples: %ums, %d%% flicker.\n",
+                  (unsigned int) (2000 / m->frequency),
+                  (int) round(m->flicker));
+    return n;
+}
+
+/* Write a report, dropping whatever doesn't fit just like the
+ * firmware's USB console does when nobody is reading. */
+static void meter_emit(struct meter *m)
+{
+    char buf[8192];
+    size_t len = meter_report(m, buf, sizeof buf);
+    ssize_t n = write(m->master, buf, len);
+    m->reports++;
+    if (n < (ssize_t) len) {
+        m->dropped++;
+    }
+}
+
+/* Make sure we can open a terminal per meter. */
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-n COUNT] [-i MS] [-d DIR] [-e PCT]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:d:e:")) != -1) {
+        switch (opt) {
+        case 'n': meter_count = strtoul(optarg, NULL, 0); break;
+        case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+        case 'd': dir = optarg; break;
+        case 'e': error_percent = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || meter_count == 0 || interval_ms == 0) {
+        usage(argv[0]);
+    }
+
+    raise_fd_limit();
+    srandom(getpid());
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    meters = calloc(meter_count, sizeof *meters);
+    if (!meters) {
+        die("calloc");
+    }
+    for (unsigned int i = 0; i < meter_count; i++) {
+        meter_open(&meters[i], i, dir);
+        printf("%s\n", meters[i].name);
+    }
+    fflush(stdout);
+
+    while (!stop) {
+        uint64_t now = now_ms();
+        for (unsigned int i = 0; i < meter_count; i++) {
+            struct meter *m = &meters[i];
+            if (now >= m->due) {
+                meter_emit(m);
+                /* Real measurements don't take exactly the same time. */
+                m->due = now + interval_ms * uniform(0.9, 1.1);
+            }
+        }
+        struct timespec tick = { .tv_nsec = TICK_MS * 1000000 };
+        nanosleep(&tick, NULL);
+    }
+
+    unsigned long reports = 0, dropped = 0;
+    for (unsigned int i = 0; i < meter_count; i++) {
+        reports += meters[i].reports;
+        dropped += meters[i].dropped;
+    }
+    fprintf(stderr, "%u meters, %lu reports, %lu dropped\n",
+            meter_count, reports, dropped);
+    return 0;
+}